@@ -0,0 +1,372 @@
+#ifndef _BATCH_WRITER_HPP_
+#define _BATCH_WRITER_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <boost/optional.hpp>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ranking.hpp"
+
+// Bounded lock-free multi-producer / single-consumer ring.
+//
+// Each cell carries a sequence number: a producer claims a slot with one CAS
+// on tail and publishes it by bumping the cell's sequence, the consumer owns
+// head outright. push() fails instead of blocking when the ring is full.
+template <typename T>
+class MpscRing {
+ public:
+  explicit MpscRing(size_t capacity) : mask(round_up(capacity) - 1) {
+    cells.reset(new Cell[mask + 1]);
+    for (size_t i = 0; i <= mask; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~MpscRing() {
+    T value;
+    while (pop(value)) {
+    }
+  }
+
+  template <typename U>
+  bool push(U &&value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    new (&cell->storage) T(std::forward<U>(value));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only
+  bool pop(T &value) {
+    Cell *cell = &cells[head & mask];
+    if (cell->seq.load(std::memory_order_acquire) != head + 1) return false;
+    T *slot = reinterpret_cast<T *>(&cell->storage);
+    value = std::move(*slot);
+    slot->~T();
+    cell->seq.store(head + mask + 1, std::memory_order_release);
+    head++;
+    return true;
+  }
+
+  size_t size() const {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head_seen.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+
+  // consumer only, publishes head for size()
+  void sync() { head_seen.store(head, std::memory_order_relaxed); }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  static size_t round_up(size_t n) {
+    size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  const size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  std::atomic<size_t> tail{0};
+  // keep the producers' tail off the consumer's cache line
+  char pad[64];
+  size_t head = 0;
+  std::atomic<size_t> head_seen{0};
+};
+
+// Write-ahead queue in front of Ranking.
+//
+// Any thread submits put / modify / incr / remove; one writer thread drains
+// the queue and applies up to max_batch operations under a single write lock,
+// then reports each result (false: uid already present for put, missing for
+// the others) through a future or a callback. Callbacks run on the writer
+// thread after the lock is released and must not block.
+//
+// A write that throws, bad_alloc when the segment cannot grow say, ends its
+// batch: the writes before it stand, it and the rest of the batch fail with
+// its exception, which futures rethrow and callbacks get as error.
+//
+// A call runs a job in its place in the queue, outside the write lock, for
+// writes that lock for themselves, like Ranking::bulk_put.
+//
+// The writer sleeps while the queue is empty; the producer that finds it
+// asleep wakes it.
+//
+// Incrs of one uid in a batch are summed into the first of them, as long as
+// no other write to the uid comes between and the deltas of a score agree in
+// sign, so the sum stops at 0 or UINT32_MAX just like the steps would: a
+// burst of events for a user moves its nodes once per batch.
+class BatchWriter {
+ public:
+  // ok is the result, error is set when the write failed instead
+  typedef std::function<void(bool ok, std::exception_ptr error)> callback_t;
+
+  BatchWriter(Ranking &rank_, size_t capacity = 1 << 14,
+              size_t max_batch_ = 256)
+      : rank(rank_), ring(capacity), max_batch(max_batch_) {
+    worker = std::thread([this]() { run(); });
+  }
+
+  ~BatchWriter() {
+    stopping.store(true);
+    wake();
+    worker.join();
+  }
+
+  void put(User user, callback_t done) {
+    submit(Task{Op::put, user.uid, std::move(user), std::move(done)});
+  }
+
+  void modify(User user, callback_t done) {
+    submit(Task{Op::modify, user.uid, std::move(user), std::move(done)});
+  }
+
+  // a delta past UINT32_MAX saturates the score like UINT32_MAX does
+  void incr(uint32_t uid, deltas_t deltas, callback_t done) {
+    for (auto &delta : deltas) delta = clamp_delta(delta);
+    submit(Task{Op::incr, uid, boost::none, std::move(done), deltas});
+  }
+
+  void remove(uint32_t uid, callback_t done) {
+    submit(Task{Op::remove, uid, boost::none, std::move(done)});
+  }
+
+  // job() gives the result
+  void call(std::function<bool()> job, callback_t done) {
+    submit(Task{Op::call, 0, boost::none, std::move(done), {},
+                std::move(job)});
+  }
+
+  std::future<bool> put(User user) {
+    return with_future([&](callback_t done) { put(std::move(user), done); });
+  }
+
+  std::future<bool> modify(User user) {
+    return with_future(
+        [&](callback_t done) { modify(std::move(user), done); });
+  }
+
+  std::future<bool> incr(uint32_t uid, const deltas_t &deltas) {
+    return with_future([&](callback_t done) { incr(uid, deltas, done); });
+  }
+
+  std::future<bool> remove(uint32_t uid) {
+    return with_future([&](callback_t done) { remove(uid, done); });
+  }
+
+  std::future<bool> call(std::function<bool()> job) {
+    return with_future([&](callback_t done) { call(std::move(job), done); });
+  }
+
+  size_t depth() const { return ring.size(); }
+
+ private:
+  enum class Op { put, modify, incr, remove, call };
+
+  struct Task {
+    Op op;
+    uint32_t uid;
+    boost::optional<User> user;
+    callback_t done;
+    deltas_t deltas = {};
+    std::function<bool()> job;
+  };
+
+  Ranking &rank;
+  MpscRing<Task> ring;
+  const size_t max_batch;
+  std::thread worker;
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> sleeping{false};
+  std::mutex sleep_mtx;
+  std::condition_variable sleep_cv;
+
+  void submit(Task &&task) {
+    // the ring is full: the writer is behind, back off until it catches up
+    while (!ring.push(std::move(task))) std::this_thread::yield();
+    // pairs with the fence in run(): either the writer sees the task before
+    // it sleeps or the producer sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) wake();
+  }
+
+  template <typename Submit>
+  static std::future<bool> with_future(Submit &&submit) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    submit([promise](bool ok, std::exception_ptr error) {
+      if (error)
+        promise->set_exception(error);
+      else
+        promise->set_value(ok);
+    });
+    return future;
+  }
+
+  static int64_t clamp_delta(int64_t delta) {
+    return std::max<int64_t>(-int64_t(UINT32_MAX),
+                             std::min<int64_t>(delta, UINT32_MAX));
+  }
+
+  static bool same_signs(const deltas_t &a, const deltas_t &b) {
+    for (int f = 0; f < score_field_cnt; f++)
+      if ((a[f] < 0 && b[f] > 0) || (a[f] > 0 && b[f] < 0)) return false;
+    return true;
+  }
+
+  // Sets carrier[i] to the task that applies task i: i itself, or the incr
+  // it is summed into. order is scratch space.
+  static void fold_incrs(std::vector<Task> &batch, size_t cnt,
+                         std::vector<size_t> &carrier,
+                         std::vector<size_t> &order) {
+    for (size_t i = 0; i < cnt; i++) carrier[i] = order[i] = i;
+    // the writes of each uid together, in submission order
+    std::sort(order.begin(), order.begin() + cnt, [&](size_t a, size_t b) {
+      return batch[a].uid != batch[b].uid ? batch[a].uid < batch[b].uid
+                                          : a < b;
+    });
+    size_t open = cnt;
+    for (size_t k = 0; k < cnt; k++) {
+      size_t i = order[k];
+      Task &task = batch[i];
+      if (k && batch[order[k - 1]].uid != task.uid) open = cnt;
+      if (task.op != Op::incr) {
+        open = cnt;
+      } else if (open != cnt && same_signs(batch[open].deltas, task.deltas)) {
+        for (int f = 0; f < score_field_cnt; f++)
+          batch[open].deltas[f] += task.deltas[f];
+        carrier[i] = open;
+      } else {
+        open = i;
+      }
+    }
+  }
+
+  void wake() {
+    std::lock_guard<std::mutex> lock(sleep_mtx);
+    sleep_cv.notify_one();
+  }
+
+  void run() {
+    std::vector<Task> batch(max_batch);
+    std::vector<bool> results(max_batch);
+    std::vector<size_t> carrier(max_batch), order(max_batch);
+
+    while (true) {
+      size_t cnt = 0, incrs = 0, calls = 0;
+      while (cnt < max_batch && ring.pop(batch[cnt])) {
+        incrs += batch[cnt].op == Op::incr;
+        calls += batch[cnt++].op == Op::call;
+      }
+      ring.sync();
+
+      if (!cnt) {
+        if (stopping.load()) return;
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        sleeping.store(true, std::memory_order_relaxed);
+        // a producer may have pushed before it could see sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ring.size() && !stopping.load()) sleep_cv.wait(lock);
+        sleeping.store(false, std::memory_order_relaxed);
+        continue;
+      }
+
+      // a call may write any uid, nothing is summed across it
+      if (incrs > 1 && !calls)
+        fold_incrs(batch, cnt, carrier, order);
+      else
+        for (size_t i = 0; i < cnt; i++) carrier[i] = i;
+
+      // the task that threw, cnt when none did
+      size_t failed = 0;
+      std::exception_ptr error;
+      try {
+        apply(batch, cnt, carrier, results, failed);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      for (size_t i = 0; i < cnt; i++) {
+        if (batch[i].done) {
+          if (carrier[i] < failed)
+            batch[i].done(results[carrier[i]], nullptr);
+          else
+            batch[i].done(false, error);
+        }
+        batch[i] = Task();
+      }
+    }
+  }
+
+  // Applies the carriers of the batch in order, the writes between calls
+  // under one write lock. failed is the task being applied, cnt once all
+  // are.
+  void apply(std::vector<Task> &batch, size_t cnt,
+             const std::vector<size_t> &carrier, std::vector<bool> &results,
+             size_t &failed) {
+    size_t i = 0;
+    while (i < cnt) {
+      if (batch[i].op == Op::call) {
+        failed = i;
+        results[i] = batch[i].job();
+        i++;
+        continue;
+      }
+      rank.write_batch([&](Ranking::Batch &writes) {
+        for (; i < cnt && batch[i].op != Op::call; i++) {
+          Task &task = batch[i];
+          failed = i;
+          if (carrier[i] != i) continue;
+          switch (task.op) {
+            case Op::put:
+              results[i] = writes.put(std::move(*task.user));
+              break;
+            case Op::modify:
+              results[i] = writes.modify(*task.user);
+              break;
+            case Op::incr:
+              results[i] = writes.incr(task.uid, task.deltas);
+              break;
+            case Op::remove:
+              results[i] = writes.remove(task.uid);
+              break;
+            case Op::call:
+              break;
+          }
+        }
+      });
+    }
+    failed = cnt;
+  }
+};
+
+#endif  // !_BATCH_WRITER_HPP_
@@ -0,0 +1,217 @@
+#ifndef _BULK_LOADER_HPP_
+#define _BULK_LOADER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <boost/utility/string_view.hpp>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "user_parser.hpp"
+
+// Users of a bulk import, sorted by uid for Ranking::bulk_put. Names point
+// into the input, or into decoded for the ones that had escapes, so the
+// input has to outlive the records. A list, so the names never move.
+struct BulkRecords {
+  std::vector<UserFields> users;
+  std::list<std::string> decoded;
+};
+
+// Bulk imports come in either of two formats:
+//
+//   NDJSON  one /put object per line, blank lines skipped
+//   binary  bulk_magic, then per user the uid and the scores of
+//           score_fields in order as little-endian uint32_t, the name
+//           length as a little-endian uint16_t and the name bytes
+static constexpr char bulk_magic[4] = {'U', 'R', 'E', 'C'};
+// the bytes of a binary record before its name
+static constexpr int bulk_head = 4 + 4 * score_field_cnt + 2;
+
+namespace bulk_detail {
+
+inline uint32_t load_le(const unsigned char* p, int bytes) {
+  uint32_t v = 0;
+  for (int i = bytes - 1; i >= 0; i--) v = v << 8 | p[i];
+  return v;
+}
+
+// Hops over the binary records after the magic by their name lengths alone,
+// cutting them into parts of about equal bytes: cuts[i] is where part i
+// starts and bounds[i] how many records come before it.
+inline bool cut_binary(boost::string_view in, unsigned parts,
+                       std::vector<const unsigned char*>& cuts,
+                       std::vector<size_t>& bounds, uint64_t& bad_at) {
+  const unsigned char* begin =
+      reinterpret_cast<const unsigned char*>(in.data()) + sizeof(bulk_magic);
+  const unsigned char* end = reinterpret_cast<const unsigned char*>(in.end());
+  const unsigned char* p = begin;
+  size_t bytes = end - begin;
+  cuts.assign(1, begin);
+  bounds.assign(1, 0);
+  for (bad_at = 1; p != end; bad_at++) {
+    if (static_cast<size_t>(p - begin) >= bytes * cuts.size() / parts) {
+      cuts.push_back(p);
+      bounds.push_back(bad_at - 1);
+    }
+    if (end - p < bulk_head) return false;
+    uint32_t len = load_le(p + bulk_head - 2, 2);
+    p += bulk_head;
+    if (static_cast<uint32_t>(end - p) < len) return false;
+    p += len;
+  }
+  cuts.push_back(end);
+  bounds.push_back(bad_at - 1);
+  return true;
+}
+
+// The whole records [p, end) into out.
+inline void parse_binary(const unsigned char* p, const unsigned char* end,
+                         UserFields* out) {
+  for (; p != end; out++) {
+    out->uid = load_le(p, 4);
+    for (int i = 0; i < score_field_cnt; i++)
+      out->scores[i] = load_le(p + 4 + 4 * i, 4);
+    uint32_t len = load_le(p + bulk_head - 2, 2);
+    p += bulk_head;
+    out->name = boost::string_view(reinterpret_cast<const char*>(p), len);
+    p += len;
+  }
+}
+
+// Lines [begin, end) of an NDJSON input, end at a line start or at the end.
+// A name the parser decoded is copied out before the next line reuses its
+// buffer.
+inline bool parse_lines(const char* begin, const char* end, BulkRecords& out,
+                        uint64_t& bad_line) {
+  UserParser parser;
+  for (bad_line = 1; begin != end; bad_line++) {
+    const char* eol =
+        static_cast<const char*>(memchr(begin, '\n', end - begin));
+    if (!eol) eol = end;
+    boost::string_view line(begin, eol - begin);
+    begin = eol == end ? end : eol + 1;
+
+    if (line.find_first_not_of(" \t\r") == boost::string_view::npos) continue;
+    UserFields fields;
+    if (parser.parse(line, fields) != UserParser::Status::ok) return false;
+    if (fields.name.data() < line.data() || fields.name.data() >= line.end()) {
+      out.decoded.emplace_back(fields.name.data(), fields.name.size());
+      fields.name = out.decoded.back();
+    }
+    out.users.push_back(fields);
+  }
+  return true;
+}
+
+inline bool uid_less(const UserFields& a, const UserFields& b) {
+  return a.uid < b.uid;
+}
+
+// Merges the sorted runs [bounds[i], bounds[i + 1]) of users pairwise, each
+// round on its own threads, stable so earlier runs win ties.
+inline void merge_runs(std::vector<UserFields>& users,
+                       std::vector<size_t> bounds) {
+  while (bounds.size() > 2) {
+    std::vector<std::thread> threads;
+    std::vector<size_t> merged;
+    size_t i = 0;
+    for (; i + 2 < bounds.size(); i += 2) {
+      auto first = users.begin() + bounds[i];
+      auto middle = users.begin() + bounds[i + 1];
+      auto last = users.begin() + bounds[i + 2];
+      threads.emplace_back([first, middle, last]() {
+        std::inplace_merge(first, middle, last, uid_less);
+      });
+      merged.push_back(bounds[i]);
+    }
+    for (; i < bounds.size(); i++) merged.push_back(bounds[i]);
+    for (auto& t : threads) t.join();
+    bounds.swap(merged);
+  }
+}
+
+}  // namespace bulk_detail
+
+// Tells the formats apart by the magic, parses on up to threads threads and
+// sorts the users by uid, the first of a repeated uid first. On a bad line
+// or a truncated record it returns false with bad_at set to the 1-based line
+// or record.
+inline bool parse_bulk(boost::string_view in, BulkRecords& out,
+                       uint64_t& bad_at, unsigned threads = 1) {
+  using namespace bulk_detail;
+  out.users.clear();
+  out.decoded.clear();
+
+  threads = std::max(1u, std::min<unsigned>(threads, in.size() / 4096 + 1));
+
+  // one part per thread, cut at record starts, parsed and sorted in place
+  if (in.size() >= sizeof(bulk_magic) &&
+      !memcmp(in.data(), bulk_magic, sizeof(bulk_magic))) {
+    std::vector<const unsigned char*> cuts;
+    std::vector<size_t> bounds;
+    if (!cut_binary(in, threads, cuts, bounds, bad_at)) return false;
+    out.users.resize(bounds.back());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i + 1 < bounds.size(); i++)
+      workers.emplace_back([&, i]() {
+        UserFields* first = out.users.data() + bounds[i];
+        parse_binary(cuts[i], cuts[i + 1], first);
+        std::stable_sort(first, out.users.data() + bounds[i + 1], uid_less);
+      });
+    for (auto& t : workers) t.join();
+    merge_runs(out.users, bounds);
+    return true;
+  }
+
+  // one part per thread, cut at line starts
+  std::vector<const char*> cuts{in.begin()};
+  for (unsigned i = 1; i < threads; i++) {
+    const char* cut =
+        std::max(cuts.back(), in.begin() + in.size() * i / threads);
+    const char* eol =
+        static_cast<const char*>(memchr(cut, '\n', in.end() - cut));
+    cuts.push_back(eol ? eol + 1 : in.end());
+  }
+  cuts.push_back(in.end());
+
+  std::vector<BulkRecords> parts(threads);
+  std::vector<uint64_t> bad(threads, 0);
+  std::vector<char> ok(threads, 0);
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; i++)
+    workers.emplace_back([&, i]() {
+      ok[i] = parse_lines(cuts[i], cuts[i + 1], parts[i], bad[i]);
+      if (ok[i])
+        std::stable_sort(parts[i].users.begin(), parts[i].users.end(),
+                         uid_less);
+    });
+  for (auto& t : workers) t.join();
+
+  // line numbers restart in every part
+  uint64_t lines = 0;
+  for (unsigned i = 0; i < threads; i++) {
+    if (!ok[i]) {
+      bad_at = lines + bad[i];
+      return false;
+    }
+    lines += std::count(cuts[i], cuts[i + 1], '\n');
+  }
+
+  std::vector<size_t> bounds{0};
+  size_t total = 0;
+  for (auto& part : parts) total += part.users.size();
+  out.users.reserve(total);
+  for (auto& part : parts) {
+    out.users.insert(out.users.end(), part.users.begin(), part.users.end());
+    bounds.push_back(out.users.size());
+    out.decoded.splice(out.decoded.end(), part.decoded);
+  }
+  merge_runs(out.users, bounds);
+  return true;
+}
+
+#endif  // !_BULK_LOADER_HPP_
@@ -0,0 +1,160 @@
+#ifndef _COMPACT_STRING_HPP_
+#define _COMPACT_STRING_HPP_
+
+#include <stdint.h>
+
+#include <boost/interprocess/offset_ptr.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <ostream>
+
+// String for shared memory segments, in 24 bytes.
+//
+// Up to 23 chars are kept inline and cost no allocation; the last byte holds
+// 23 - size, so a full inline string ends in its own terminator. Longer ones
+// live in the segment behind an offset_ptr, next to an offset_ptr to the
+// segment manager that frees them, and the last byte says so. Both pointers
+// are relative, so every process mapping the segment can read the string
+// wherever it maps it.
+template <typename Allocator>
+class CompactString {
+ public:
+  typedef typename Allocator::segment_manager segment_manager;
+  static constexpr size_t inline_capacity = 23;
+
+  explicit CompactString(const Allocator &) { set_inline(nullptr, 0); }
+
+  CompactString(const char *str, const Allocator &a)
+      : CompactString(boost::string_view(str), a) {}
+
+  CompactString(boost::string_view str, const Allocator &a) {
+    set(str, a.get_segment_manager());
+  }
+
+  // a long string is copied within the segment of the original
+  CompactString(const CompactString &other) {
+    set(other.view(), other.manager());
+  }
+
+  CompactString(CompactString &&other) noexcept { steal(other); }
+
+  ~CompactString() {
+    // here, where the class is complete: the flag byte is last and outside
+    // the long layout
+    static_assert(sizeof(CompactString) == 24, "CompactString is 24 bytes");
+    static_assert(offsetof(Heap, size) + sizeof(Heap::size) <= inline_capacity,
+                  "Heap stops short of the flag byte");
+    release();
+  }
+
+  CompactString &operator=(const CompactString &other) {
+    if (this != &other) assign(other.view(), other.manager());
+    return *this;
+  }
+
+  CompactString &operator=(CompactString &&other) noexcept {
+    if (this != &other) {
+      release();
+      steal(other);
+    }
+    return *this;
+  }
+
+  void assign(boost::string_view str, const Allocator &a) {
+    assign(str, a.get_segment_manager());
+  }
+
+  size_t size() const {
+    return is_long() ? heap.size : inline_capacity - bytes[inline_capacity];
+  }
+  bool empty() const { return !size(); }
+
+  const char *data() const { return is_long() ? heap.data.get() : bytes; }
+  const char *c_str() const { return data(); }
+  const char *begin() const { return data(); }
+  const char *end() const { return data() + size(); }
+
+  boost::string_view view() const { return boost::string_view(data(), size()); }
+
+  bool operator==(boost::string_view str) const { return view() == str; }
+
+  friend std::ostream &operator<<(std::ostream &os, const CompactString &str) {
+    return os.write(str.data(), str.size());
+  }
+
+ private:
+  static constexpr unsigned char long_flag = 0xff;
+
+  struct Heap {
+    boost::interprocess::offset_ptr<char> data;
+    boost::interprocess::offset_ptr<segment_manager> mgr;
+    uint32_t size;
+  };
+
+  union {
+    char bytes[inline_capacity + 1];
+    Heap heap;
+  };
+
+  bool is_long() const {
+    return static_cast<unsigned char>(bytes[inline_capacity]) == long_flag;
+  }
+
+  segment_manager *manager() const {
+    return is_long() ? heap.mgr.get() : nullptr;
+  }
+
+  void set_inline(const char *str, size_t n) {
+    if (n) std::memcpy(bytes, str, n);
+    bytes[n] = '\0';
+    bytes[inline_capacity] = static_cast<char>(inline_capacity - n);
+  }
+
+  // mgr only has to be known for strings that do not fit inline
+  void set(boost::string_view str, segment_manager *mgr) {
+    if (str.size() <= inline_capacity) {
+      set_inline(str.data(), str.size());
+      return;
+    }
+    char *p = static_cast<char *>(mgr->allocate(str.size() + 1));
+    std::memcpy(p, str.data(), str.size());
+    p[str.size()] = '\0';
+    new (&heap.data) boost::interprocess::offset_ptr<char>(p);
+    new (&heap.mgr) boost::interprocess::offset_ptr<segment_manager>(mgr);
+    heap.size = static_cast<uint32_t>(str.size());
+    bytes[inline_capacity] = static_cast<char>(long_flag);
+  }
+
+  CompactString(boost::string_view str, segment_manager *mgr) {
+    set(str, mgr);
+  }
+
+  void assign(boost::string_view str, segment_manager *mgr) {
+    // build first: str may point into this string, and set may throw
+    CompactString fresh(str, mgr ? mgr : manager());
+    release();
+    steal(fresh);
+  }
+
+  void release() {
+    if (is_long()) heap.mgr->deallocate(heap.data.get());
+    set_inline(nullptr, 0);
+  }
+
+  void steal(CompactString &other) {
+    if (other.is_long()) {
+      new (&heap.data) boost::interprocess::offset_ptr<char>(other.heap.data);
+      new (&heap.mgr)
+          boost::interprocess::offset_ptr<segment_manager>(other.heap.mgr);
+      heap.size = other.heap.size;
+      bytes[inline_capacity] = static_cast<char>(long_flag);
+    } else {
+      std::memcpy(bytes, other.bytes, sizeof(bytes));
+    }
+    other.set_inline(nullptr, 0);
+  }
+};
+
+#endif  // !_COMPACT_STRING_HPP_
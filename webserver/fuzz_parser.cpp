@@ -0,0 +1,77 @@
+// libFuzzer target for RequestParser, seeded from fuzz/corpus.
+//
+//   make fuzz_parser && ./fuzz_parser fuzz/corpus
+//   make fuzz_replay && ./fuzz_replay fuzz/corpus/*
+//
+// Every input is parsed as a stream of pipelined requests twice, once in one
+// piece and once fed in two pieces split at a position picked from the input,
+// and both runs have to agree.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "http_parser.hpp"
+
+struct Outcome {
+  std::vector<size_t> consumed;
+  RequestParser::Status last;
+};
+
+// the second piece lands in a new buffer, like a streambuf that had to grow
+static Outcome parse_stream(const char* data, size_t size, size_t split) {
+  Outcome outcome;
+  RequestParser parser;
+  Request request;
+  std::string buffer(data, split);
+  size_t offset = 0;
+
+  while (true) {
+    const char* begin = buffer.data();
+    auto status =
+        parser.parse(begin + offset, begin + buffer.size(), request);
+    if (status == RequestParser::Status::incomplete && buffer.size() < size) {
+      std::string(data, size).swap(buffer);
+      continue;
+    }
+    outcome.last = status;
+    if (status != RequestParser::Status::complete) return outcome;
+
+    assert(parser.consumed() > 0 &&
+           offset + parser.consumed() <= buffer.size());
+    assert(request.method.data() == begin + offset);
+    assert(request.content.size() <= parser.consumed());
+    outcome.consumed.push_back(parser.consumed());
+    offset += parser.consumed();
+    parser.reset();
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  const char* bytes = reinterpret_cast<const char*>(data);
+  Outcome whole = parse_stream(bytes, size, size);
+  Outcome split = parse_stream(bytes, size, size ? data[0] % (size + 1) : 0);
+  assert(whole.last == split.last);
+  assert(whole.consumed == split.consumed);
+  return 0;
+}
+
+#ifdef FUZZ_REPLAY
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::ifstream in(argv[i], std::ios::binary);
+    std::string input((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()),
+                           input.size());
+    std::cout << argv[i] << "\tok" << std::endl;
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,314 @@
+#ifndef _HTTP_PARSER_HPP_
+#define _HTTP_PARSER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+struct HttpHeader {
+  boost::string_view name, value;
+};
+
+// Fixed-capacity header list, looked up case-insensitively.
+class HttpHeaders {
+ public:
+  static constexpr size_t capacity = 32;
+
+  void clear() { cnt = 0; }
+
+  bool push(boost::string_view name, boost::string_view value) {
+    if (cnt == capacity) return false;
+    headers[cnt++] = {name, value};
+    return true;
+  }
+
+  const HttpHeader* find(boost::string_view name) const {
+    for (size_t i = 0; i < cnt; i++)
+      if (iequals(headers[i].name, name)) return &headers[i];
+    return nullptr;
+  }
+
+  size_t count(boost::string_view name) const { return find(name) ? 1 : 0; }
+
+  const HttpHeader* begin() const { return headers; }
+  const HttpHeader* end() const { return headers + cnt; }
+  size_t size() const { return cnt; }
+
+  static bool iequals(boost::string_view a, boost::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+      if (lower(a[i]) != lower(b[i])) return false;
+    return true;
+  }
+
+ private:
+  HttpHeader headers[capacity];
+  size_t cnt = 0;
+
+  static char lower(char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+  }
+};
+
+// Every view points into the read buffer the request was parsed from and is
+// only valid until that buffer is consumed or grown.
+struct Request {
+  boost::string_view method, path, http_version;
+  boost::string_view content;
+  HttpHeaders header;
+  // numeric tail of a {uint} route, filled by the router
+  uint32_t path_param = 0;
+  // pre-rendered body a handler can send instead of writing one
+  std::shared_ptr<const std::string> shared_response;
+
+  // Answering later, for handlers that wait on something: the handler calls
+  // defer() and leaves the body alone, then calls the reply once, from any
+  // thread, with what writes the body. The request's views stay valid until
+  // then. The server sets make_reply.
+  typedef std::function<void(std::ostream&)> body_t;
+  typedef std::function<void(body_t)> reply_t;
+  std::function<reply_t()> make_reply;
+  bool deferred = false;
+
+  reply_t defer() {
+    deferred = true;
+    return make_reply();
+  }
+};
+
+// Value of key in the query string of target, "/top?index=exp_pers&count=5".
+// No percent-decoding: the service only takes plain names and numbers.
+inline bool find_query_param(boost::string_view target, boost::string_view key,
+                             boost::string_view& value) {
+  size_t q = target.find('?');
+  if (q == boost::string_view::npos) return false;
+  boost::string_view query = target.substr(q + 1);
+  while (!query.empty()) {
+    size_t amp = query.find('&');
+    boost::string_view pair = query.substr(0, amp);
+    size_t eq = pair.find('=');
+    if (pair.substr(0, eq) == key) {
+      value = eq == boost::string_view::npos ? boost::string_view()
+                                             : pair.substr(eq + 1);
+      return true;
+    }
+    if (amp == boost::string_view::npos) break;
+    query.remove_prefix(amp + 1);
+  }
+  return false;
+}
+
+// Decimal uint32_t, the whole view or nothing.
+inline bool parse_uint(boost::string_view text, uint32_t& value) {
+  if (text.empty()) return false;
+  uint64_t v = 0;
+  for (char ch : text) {
+    if (ch < '0' || ch > '9') return false;
+    v = v * 10 + (ch - '0');
+    if (v > UINT32_MAX) return false;
+  }
+  value = static_cast<uint32_t>(v);
+  return true;
+}
+
+// an optional minus and the digits of parse_uint
+inline bool parse_int(boost::string_view text, int64_t& value) {
+  bool negative = !text.empty() && text.front() == '-';
+  if (negative) text.remove_prefix(1);
+  uint32_t magnitude;
+  if (!parse_uint(text, magnitude)) return false;
+  value = negative ? -int64_t(magnitude) : int64_t(magnitude);
+  return true;
+}
+
+// Tokens of text separated by commas or whitespace, passed to f(token) in
+// order until f returns false. Returns whether every token was taken.
+template <typename Func>
+bool for_each_token(boost::string_view text, Func&& f) {
+  auto separator = [](char ch) {
+    return ch == ',' || ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+  };
+  const char* p = text.begin();
+  while (p != text.end()) {
+    if (separator(*p)) {
+      p++;
+      continue;
+    }
+    const char* begin = p;
+    while (p != text.end() && !separator(*p)) p++;
+    if (!f(boost::string_view(begin, p - begin))) return false;
+  }
+  return true;
+}
+
+// Whether the connection stays open after answering request: HTTP/1.1 and
+// later keep it unless the Connection header lists close, HTTP/1.0 only when
+// it lists keep-alive.
+inline bool keep_alive(const Request& request) {
+  bool persistent = request.http_version > "1.0";
+  const HttpHeader* connection = request.header.find("Connection");
+  if (!connection) return persistent;
+  boost::string_view tokens = connection->value;
+  while (!tokens.empty()) {
+    size_t comma = tokens.find(',');
+    boost::string_view token = tokens.substr(0, comma);
+    while (!token.empty() && (token.front() == ' ' || token.front() == '\t'))
+      token.remove_prefix(1);
+    while (!token.empty() && (token.back() == ' ' || token.back() == '\t'))
+      token.remove_suffix(1);
+    if (HttpHeaders::iequals(token, "close")) return false;
+    if (HttpHeaders::iequals(token, "keep-alive")) persistent = true;
+    if (comma == boost::string_view::npos) break;
+    tokens.remove_prefix(comma + 1);
+  }
+  return persistent;
+}
+
+// Incremental HTTP/1.1 request parser working in place on the read buffer.
+//
+// parse() is called with everything buffered so far, starting at the first
+// byte of the request. It keeps how far it already scanned, so feeding a
+// request a few bytes at a time stays linear. On complete, consumed() bytes
+// belong to this request; whatever follows is the next pipelined request.
+// reset() before parsing the next one.
+class RequestParser {
+ public:
+  enum class Status { complete, incomplete, bad };
+
+  explicit RequestParser(size_t max_content_length_ = 64 << 20)
+      : max_content_length(max_content_length_) {}
+
+  void reset() {
+    base = nullptr;
+    scanned = head_len = content_len = 0;
+  }
+
+  size_t consumed() const { return head_len + content_len; }
+
+  Status parse(const char* begin, const char* end, Request& request) {
+    size_t size = end - begin;
+
+    if (!head_len) {
+      // resume the search for the blank line a few bytes back
+      size_t from = scanned > 3 ? scanned - 3 : 0;
+      const char* blank = find_blank_line(begin + from, end);
+      if (!blank) {
+        scanned = size;
+        return Status::incomplete;
+      }
+      head_len = blank + 4 - begin;
+      base = nullptr;
+    }
+
+    // the buffer may have moved since the head was parsed
+    if (base != begin) {
+      if (!parse_head(begin, begin + head_len, request)) return Status::bad;
+      base = begin;
+    }
+
+    if (size < head_len + content_len) return Status::incomplete;
+    request.content = boost::string_view(begin + head_len, content_len);
+    return Status::complete;
+  }
+
+ private:
+  const size_t max_content_length;
+  const char* base = nullptr;
+  size_t scanned = 0, head_len = 0, content_len = 0;
+
+  static const char* find_blank_line(const char* p, const char* end) {
+    while (end - p >= 4) {
+      const char* cr = static_cast<const char*>(memchr(p, '\r', end - p - 3));
+      if (!cr) return nullptr;
+      if (cr[1] == '\n' && cr[2] == '\r' && cr[3] == '\n') return cr;
+      p = cr + 1;
+    }
+    return nullptr;
+  }
+
+  static bool is_token(char ch) {
+    return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') ||
+           (ch >= '0' && ch <= '9') || (ch && strchr("!#$%&'*+-.^_`|~", ch));
+  }
+
+  // [p, end) is one line without its CRLF
+  static const char* take_until(const char* p, const char* end, char ch) {
+    while (p != end && *p != ch) p++;
+    return p;
+  }
+
+  bool parse_head(const char* p, const char* end, Request& request) {
+    request.header.clear();
+    request.content.clear();
+    // head ends with an empty line, drop its CRLF
+    end -= 2;
+
+    const char* eol = take_until(p, end, '\r');
+    if (eol == end || eol[1] != '\n') return false;
+
+    // request line: method SP target SP HTTP/version
+    const char* sp = take_until(p, eol, ' ');
+    if (sp == p || sp == eol) return false;
+    for (const char* c = p; c != sp; c++)
+      if (!is_token(*c)) return false;
+    request.method = boost::string_view(p, sp - p);
+
+    p = sp + 1;
+    sp = take_until(p, eol, ' ');
+    if (sp == p || sp == eol) return false;
+    request.path = boost::string_view(p, sp - p);
+
+    p = sp + 1;
+    if (eol - p < 6 || memcmp(p, "HTTP/", 5)) return false;
+    request.http_version = boost::string_view(p + 5, eol - p - 5);
+    if (take_until(p, eol, ' ') != eol) return false;
+
+    // header lines: name ":" OWS value OWS
+    content_len = 0;
+    for (p = eol + 2; p != end; p = eol + 2) {
+      eol = take_until(p, end, '\r');
+      if (eol == end || eol[1] != '\n') return false;
+
+      const char* colon = take_until(p, eol, ':');
+      if (colon == p || colon == eol) return false;
+      for (const char* c = p; c != colon; c++)
+        if (!is_token(*c)) return false;
+
+      const char* v = colon + 1;
+      const char* v_end = eol;
+      while (v != v_end && (*v == ' ' || *v == '\t')) v++;
+      while (v_end != v && (v_end[-1] == ' ' || v_end[-1] == '\t')) v_end--;
+
+      boost::string_view name(p, colon - p), value(v, v_end - v);
+      if (!request.header.push(name, value)) return false;
+
+      if (HttpHeaders::iequals(name, "Content-Length")) {
+        if (!parse_length(value, content_len)) return false;
+      } else if (HttpHeaders::iequals(name, "Transfer-Encoding")) {
+        // chunked bodies are not supported
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool parse_length(boost::string_view value, size_t& len) const {
+    if (value.empty()) return false;
+    size_t v = 0;
+    for (char ch : value) {
+      if (ch < '0' || ch > '9') return false;
+      v = v * 10 + (ch - '0');
+      if (v > max_content_length) return false;
+    }
+    len = v;
+    return true;
+  }
+};
+
+#endif  // !_HTTP_PARSER_HPP_
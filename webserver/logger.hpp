@@ -0,0 +1,223 @@
+#ifndef _LOGGER_HPP_
+#define _LOGGER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <boost/utility/string_view.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class log_level { debug, info, warn, error, off };
+
+// Logging off the service threads.
+//
+// A logging thread writes its lines into a ring of its own, one fixed-size
+// entry per line, and a drain thread copies them out to the sink every few
+// milliseconds, flushing once per round. Writing a line costs a few copies
+// into the entry and one release store: no lock, no formatting through an
+// ostream, no flush. A line longer than an entry is cut, and a line that
+// finds its ring full is dropped and counted, so a slow sink never holds a
+// service thread up.
+//
+// Lines below level are skipped. debug and info lines are also sampled: with
+// sample n, each thread writes every n-th of them. Lines of one thread come
+// out in order, lines of different threads may interleave.
+class Logger {
+ private:
+  static constexpr size_t entry_size = 256;
+  static constexpr size_t ring_entries = 1024;
+
+  struct Entry {
+    uint16_t len;
+    char text[entry_size - sizeof(uint16_t)];
+  };
+
+  // single producer, single consumer
+  struct Ring {
+    std::thread::id owner;
+    std::unique_ptr<Entry[]> entries{new Entry[ring_entries]};
+    std::atomic<uint64_t> head{0}, tail{0};
+    // bumped by the producer only
+    uint64_t sampled = 0;
+  };
+
+ public:
+  // A line being written, published when it goes out of scope. Tests false
+  // when the line is skipped, sampled out or dropped; writing to it then
+  // does nothing.
+  class Line {
+   public:
+    explicit operator bool() const { return entry; }
+
+    Line& operator<<(boost::string_view s) {
+      if (!entry) return *this;
+      size_t n = std::min(s.size(), sizeof(entry->text) - entry->len);
+      memcpy(entry->text + entry->len, s.data(), n);
+      entry->len += n;
+      return *this;
+    }
+    Line& operator<<(const char* s) { return *this << boost::string_view(s); }
+    Line& operator<<(const std::string& s) {
+      return *this << boost::string_view(s);
+    }
+    Line& operator<<(char ch) { return *this << boost::string_view(&ch, 1); }
+
+    template <typename T, typename = typename std::enable_if<
+                              std::is_integral<T>::value>::type>
+    Line& operator<<(T value) {
+      char digits[24], *p = digits + sizeof(digits);
+      bool negative = value < 0;
+      uint64_t v = negative ? 0 - static_cast<uint64_t>(value) : value;
+      do *--p = '0' + v % 10;
+      while (v /= 10);
+      if (negative) *--p = '-';
+      return *this << boost::string_view(p, digits + sizeof(digits) - p);
+    }
+
+    Line(Line&& other) : ring(other.ring), entry(other.entry) {
+      other.entry = nullptr;
+    }
+
+    ~Line() {
+      if (entry)
+        ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+    }
+
+   private:
+    friend class Logger;
+    Ring* ring = nullptr;
+    Entry* entry = nullptr;
+
+    Line() {}
+    explicit Line(Ring* ring_) : ring(ring_) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      if (tail - ring->head.load(std::memory_order_acquire) == ring_entries)
+        return;
+      entry = &ring->entries[tail % ring_entries];
+      entry->len = 0;
+    }
+  };
+
+  explicit Logger(std::ostream& sink_, log_level level_ = log_level::info,
+                  uint32_t sample_ = 1)
+      : sink(sink_), level(level_), sample(sample_ ? sample_ : 1) {
+    drainer = std::thread([this]() { run(); });
+  }
+
+  ~Logger() {
+    stopping.store(true);
+    {
+      std::lock_guard<std::mutex> lock(stop_mtx);
+      stop_cv.notify_one();
+    }
+    drainer.join();
+  }
+
+  Line line(log_level at) {
+    if (at < level.load(std::memory_order_relaxed)) return Line();
+    Ring* r = ring();
+    if (at <= log_level::info &&
+        r->sampled++ % sample.load(std::memory_order_relaxed))
+      return Line();
+    Line l(r);
+    if (!l) dropped.fetch_add(1, std::memory_order_relaxed);
+    return l;
+  }
+
+  void set_level(log_level level_) { level.store(level_); }
+  void set_sample(uint32_t sample_) { sample.store(sample_ ? sample_ : 1); }
+
+  // writes out what is logged so far
+  void flush() { drain(); }
+
+ private:
+  std::ostream& sink;
+  std::atomic<log_level> level;
+  std::atomic<uint32_t> sample;
+  std::atomic<uint64_t> dropped{0};
+  // the sink and snapshot are used under drain_mtx
+  std::mutex drain_mtx;
+  std::vector<Ring*> snapshot;
+  std::mutex rings_mtx;
+  std::vector<std::unique_ptr<Ring>> rings;
+  // tells the Loggers of several servers apart in the per-thread cache
+  const uint64_t id = next_id()++;
+  std::atomic<bool> stopping{false};
+  std::mutex stop_mtx;
+  std::condition_variable stop_cv;
+  std::thread drainer;
+  const std::chrono::milliseconds drain_interval{5};
+
+  static std::atomic<uint64_t>& next_id() {
+    static std::atomic<uint64_t> id{1};
+    return id;
+  }
+
+  Ring* ring() {
+    thread_local uint64_t cached_id = 0;
+    thread_local Ring* cached = nullptr;
+    if (cached_id == id) return cached;
+
+    std::lock_guard<std::mutex> lock(rings_mtx);
+    auto self = std::this_thread::get_id();
+    cached = nullptr;
+    for (auto& r : rings)
+      if (r->owner == self) cached = r.get();
+    if (!cached) {
+      rings.emplace_back(new Ring);
+      rings.back()->owner = self;
+      cached = rings.back().get();
+    }
+    cached_id = id;
+    return cached;
+  }
+
+  void drain() {
+    std::lock_guard<std::mutex> drain_lock(drain_mtx);
+    {
+      std::lock_guard<std::mutex> lock(rings_mtx);
+      snapshot.clear();
+      for (auto& r : rings) snapshot.push_back(r.get());
+    }
+
+    bool wrote = false;
+    for (Ring* r : snapshot) {
+      uint64_t head = r->head.load(std::memory_order_relaxed);
+      uint64_t tail = r->tail.load(std::memory_order_acquire);
+      for (; head != tail; head++) {
+        const Entry& e = r->entries[head % ring_entries];
+        sink.write(e.text, e.len);
+        sink.put('\n');
+      }
+      wrote |= head != r->head.load(std::memory_order_relaxed);
+      r->head.store(head, std::memory_order_release);
+    }
+    if (uint64_t n = dropped.exchange(0, std::memory_order_relaxed)) {
+      sink << n << " log lines dropped\n";
+      wrote = true;
+    }
+    if (wrote) sink.flush();
+  }
+
+  void run() {
+    while (!stopping.load()) {
+      drain();
+      std::unique_lock<std::mutex> lock(stop_mtx);
+      stop_cv.wait_for(lock, drain_interval,
+                       [this]() { return stopping.load(); });
+    }
+    drain();
+  }
+};
+
+#endif  // !_LOGGER_HPP_
@@ -1,7 +1,174 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
 #include "server.hpp"
 
-int main() {
-  Server server(10000, 10);
-  server.start();
+// Offline import of users into data_file, which the server then opens.
+static int import_users(const char* users_file, const std::string& data_file,
+                        const HybridWeights& weights) {
+  if (data_file.empty()) {
+    std::cerr << "-l needs a data_file to import into" << std::endl;
+    return 1;
+  }
+  int fd = ::open(users_file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    std::cerr << "cannot open " << users_file << std::endl;
+    return 1;
+  }
+  void* in = st.st_size ? ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                                 fd, 0)
+                        : nullptr;
+  ::close(fd);
+  if (in == MAP_FAILED) {
+    std::cerr << "cannot map " << users_file << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  BulkRecords records;
+  uint64_t bad_at;
+  if (!parse_bulk(boost::string_view(static_cast<const char*>(in), st.st_size),
+                  records, bad_at, std::thread::hardware_concurrency())) {
+    std::cerr << users_file << ": bad user at " << bad_at << std::endl;
+    return 1;
+  }
+  auto parsed = std::chrono::steady_clock::now();
+
+  Ranking rank(1 << 20, rank_mode::competition, weights, data_file);
+  uint64_t put = rank.bulk_put(records.users.begin(), records.users.end());
+  bool flushed = rank.flush();
+  auto done = std::chrono::steady_clock::now();
+
+  typedef std::chrono::duration<double> seconds;
+  std::cout << "put " << put << " of " << records.users.size() << " users, "
+            << "parsed in " << seconds(parsed - start).count() << "s, "
+            << "inserted in " << seconds(done - parsed).count() << "s"
+            << std::endl;
+  if (in) ::munmap(in, st.st_size);
+  return flushed ? 0 : 1;
+}
+
+static bool parse_log_level(const std::string& name, log_level& level) {
+  static const char* names[] = {"debug", "info", "warn", "error", "off"};
+  for (int i = 0; i < 5; i++)
+    if (name == names[i]) {
+      level = static_cast<log_level>(i);
+      return true;
+    }
+  return false;
+}
+
+// one weight per stored score, in score_fields order: "700,300"
+static bool parse_weights(const std::string& list, HybridWeights& weights) {
+  size_t at = 0;
+  for (int i = 0; i < score_field_cnt; i++) {
+    size_t end = list.find(',', at);
+    if ((end == std::string::npos) != (i == score_field_cnt - 1)) return false;
+    std::string weight = list.substr(at, end - at);
+    if (weight.empty() ||
+        weight.find_first_not_of("0123456789") != std::string::npos ||
+        weight.size() > 9)
+      return false;
+    weights.w[i] = std::stoul(weight);
+    at = end + 1;
+  }
+  return true;
+}
+
+// webserver [-p port] [-t threads] [-c] [-v level] [-s n] [-w period]
+//           [-W offset] [-H weights] [-r] [-l users] [data_file]
+//   data_file  the leaderboard survives restarts
+//   -t         service threads, 10 by default
+//   -c         an io_service per service thread, pinned to a core
+//   -v         log level: debug, info (default), warn, error or off
+//   -s         log every n-th request line and put, per thread
+//   -w         activity windows of period seconds, 86400 for daily boards
+//   -W         windows start offset seconds into each period, counted from
+//              the Unix epoch: 345600 starts weekly ones on Monday, UTC
+//   -H         weights of the hybrid score, one per stored score:
+//              700,300 (the default) is exp_pers * 700 + activity * 300
+//   -r         read replica of the server owning the leaderboard, which
+//              stops once that server does
+//   -l         import users (NDJSON or binary records, see bulk_loader.hpp)
+//              into data_file and exit
+int main(int argc, char* argv[]) {
+  uint32_t port = 10000;
+  uint32_t threads = 10;
+  threading model = threading::shared;
+  bool replica = false;
+  const char* users_file = nullptr;
+  log_level level = log_level::info;
+  uint32_t sample = 1;
+  uint32_t window_period = 0, window_offset = 0;
+  HybridWeights weights;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:t:cv:s:w:W:H:rl:")) != -1) {
+    switch (opt) {
+      case 'p':
+        port = std::stoul(optarg);
+        break;
+      case 't':
+        threads = std::stoul(optarg);
+        break;
+      case 'c':
+        model = threading::per_core;
+        break;
+      case 'v':
+        if (!parse_log_level(optarg, level)) {
+          std::cerr << "unknown log level " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 's':
+        sample = std::stoul(optarg);
+        break;
+      case 'w':
+        window_period = std::stoul(optarg);
+        break;
+      case 'W':
+        window_offset = std::stoul(optarg);
+        break;
+      case 'H':
+        if (!parse_weights(optarg, weights)) {
+          std::cerr << "bad weights " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'r':
+        replica = true;
+        break;
+      case 'l':
+        users_file = optarg;
+        break;
+      default:
+        std::cerr << "usage: " << argv[0]
+                  << " [-p port] [-t threads] [-c] [-v level] [-s n]"
+                     " [-w period] [-W offset] [-H weights] [-r] [-l users]"
+                     " [data_file]"
+                  << std::endl;
+        return 1;
+    }
+  }
+  std::string data_file = optind < argc ? argv[optind] : "";
+
+  if (users_file) return import_users(users_file, data_file, weights);
+
+  // an owner refuses a leaderboard another process still uses, a replica
+  // one without an owner
+  try {
+    Server server(port, threads, data_file, replica, model, weights);
+    server.get_logger().set_level(level);
+    server.get_logger().set_sample(sample);
+    server.set_windows(window_period, window_offset);
+    server.start();
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
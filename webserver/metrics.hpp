@@ -0,0 +1,224 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Log-linear latency histogram in nanoseconds, HDR style: every value below
+// 2^sub_bits has a bucket of its own and every octave above is cut into
+// 2^sub_bits buckets, so a bucket is never wider than 1/16 of the values in
+// it. Values of 2^max_octave ns (about 69 s) and more land in the last one.
+//
+// A histogram has one writer; record() is a plain load and store, which
+// snapshots on other threads may read at any time.
+class LatencyHistogram {
+ public:
+  static constexpr int sub_bits = 4;
+  static constexpr int max_octave = 36;
+  static constexpr size_t buckets = (max_octave - sub_bits + 1) << sub_bits;
+
+  // a copy to add up and read
+  struct Snapshot {
+    uint64_t counts[buckets] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    // the middle of the bucket holding the q-quantile
+    uint64_t quantile(double q) const {
+      uint64_t rank = static_cast<uint64_t>(q * count), seen = 0;
+      for (size_t i = 0; i < buckets; i++) {
+        seen += counts[i];
+        if (seen > rank) return (lower_bound(i) + lower_bound(i + 1)) / 2;
+      }
+      return lower_bound(buckets);
+    }
+  };
+
+  void record(uint64_t ns) {
+    bump(counts[index(ns)], 1);
+    bump(count, 1);
+    bump(sum, ns);
+  }
+
+  void add_to(Snapshot& snapshot) const {
+    for (size_t i = 0; i < buckets; i++)
+      snapshot.counts[i] += counts[i].load(std::memory_order_relaxed);
+    snapshot.count += count.load(std::memory_order_relaxed);
+    snapshot.sum += sum.load(std::memory_order_relaxed);
+  }
+
+  static size_t index(uint64_t ns) {
+    if (ns < (1u << sub_bits)) return ns;
+    int octave = 63 - __builtin_clzll(ns);
+    if (octave >= max_octave) return buckets - 1;
+    return ((octave - sub_bits + 1) << sub_bits) +
+           ((ns >> (octave - sub_bits)) & ((1u << sub_bits) - 1));
+  }
+
+  static uint64_t lower_bound(size_t i) {
+    if (i < (1u << sub_bits)) return i;
+    int shift = (i >> sub_bits) - 1;
+    return uint64_t((1u << sub_bits) + (i & ((1u << sub_bits) - 1))) << shift;
+  }
+
+ private:
+  std::atomic<uint64_t> counts[buckets] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+
+  static void bump(std::atomic<uint64_t>& a, uint64_t by) {
+    a.store(a.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+  }
+};
+
+// Per-route request latencies for /metrics, in Prometheus text format.
+//
+// Every thread that records gets a shard of its own, one histogram per route
+// and phase, so recording takes no lock and shares no cache line; a scrape
+// adds the shards up. Routes are numbered by set_routes, before any record.
+class Metrics {
+ public:
+  enum Phase { parse, handle, write, phase_cnt };
+
+  typedef std::chrono::steady_clock clock;
+
+  // every route's path and method, by route number
+  void set_routes(std::vector<std::pair<std::string, std::string>> routes_) {
+    routes = std::move(routes_);
+  }
+
+  void record(uint32_t route, Phase phase, clock::duration elapsed) {
+    shard().histograms[route * phase_cnt + phase].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  // gauges the server keeps up to date
+  std::atomic<int64_t> connections{0};
+  std::atomic<int64_t> in_flight{0};
+
+  // histograms of the routes that were asked for, with a few quantiles
+  // next to them
+  void write_prometheus(std::ostream& out) const {
+    static const char* phase_names[] = {"parse", "handler", "write"};
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const int first_le = 10, last_le = 35;
+
+    std::vector<LatencyHistogram::Snapshot> totals(routes.size() * phase_cnt);
+    {
+      std::lock_guard<std::mutex> lock(shards_mtx);
+      for (auto& s : shards)
+        for (size_t i = 0; i < totals.size(); i++)
+          s->histograms[i].add_to(totals[i]);
+    }
+
+    char num[32];
+    out << "# HELP webserver_request_seconds Time a request spends in each "
+           "phase.\n"
+           "# TYPE webserver_request_seconds histogram\n";
+    for (size_t i = 0; i < totals.size(); i++) {
+      auto& h = totals[i];
+      if (!h.count) continue;
+      std::string labels = series_labels(i, phase_names);
+      // octaves start on a bucket, so the le are exact
+      uint64_t below = 0;
+      size_t bucket = 0;
+      for (int octave = first_le; octave <= last_le; octave++) {
+        uint64_t le = uint64_t(1) << octave;
+        for (; bucket < LatencyHistogram::index(le); bucket++)
+          below += h.counts[bucket];
+        snprintf(num, sizeof(num), "%.9g", le * 1e-9);
+        out << "webserver_request_seconds_bucket{" << labels << ",le=\"" << num
+            << "\"} " << below << "\n";
+      }
+      out << "webserver_request_seconds_bucket{" << labels << ",le=\"+Inf\"} "
+          << h.count << "\n";
+      snprintf(num, sizeof(num), "%.9g", h.sum * 1e-9);
+      out << "webserver_request_seconds_sum{" << labels << "} " << num << "\n"
+          << "webserver_request_seconds_count{" << labels << "} " << h.count
+          << "\n";
+    }
+
+    out << "# HELP webserver_request_quantile_seconds Quantiles of "
+           "webserver_request_seconds, within 1/32.\n"
+           "# TYPE webserver_request_quantile_seconds gauge\n";
+    for (size_t i = 0; i < totals.size(); i++) {
+      auto& h = totals[i];
+      if (!h.count) continue;
+      std::string labels = series_labels(i, phase_names);
+      for (double q : quantiles) {
+        snprintf(num, sizeof(num), "%.9g", h.quantile(q) * 1e-9);
+        out << "webserver_request_quantile_seconds{" << labels
+            << ",quantile=\"" << q << "\"} " << num << "\n";
+      }
+    }
+  }
+
+ private:
+  struct Shard {
+    std::thread::id owner;
+    std::unique_ptr<LatencyHistogram[]> histograms;
+  };
+
+  std::vector<std::pair<std::string, std::string>> routes;
+  mutable std::mutex shards_mtx;
+  std::vector<std::unique_ptr<Shard>> shards;
+  // tells the Metrics of several servers apart in the per-thread cache
+  const uint64_t id = next_id()++;
+
+  static std::atomic<uint64_t>& next_id() {
+    static std::atomic<uint64_t> id{1};
+    return id;
+  }
+
+  Shard& shard() {
+    thread_local uint64_t cached_id = 0;
+    thread_local Shard* cached = nullptr;
+    if (cached_id == id) return *cached;
+
+    std::lock_guard<std::mutex> lock(shards_mtx);
+    auto self = std::this_thread::get_id();
+    cached = nullptr;
+    for (auto& s : shards)
+      if (s->owner == self) cached = s.get();
+    if (!cached) {
+      shards.emplace_back(new Shard{
+          self, std::unique_ptr<LatencyHistogram[]>(
+                    new LatencyHistogram[routes.size() * phase_cnt])});
+      cached = shards.back().get();
+    }
+    cached_id = id;
+    return *cached;
+  }
+
+  std::string series_labels(size_t i, const char* const* phase_names) const {
+    auto& route = routes[i / phase_cnt];
+    return "route=\"" + escape(route.first) + "\",method=\"" +
+           escape(route.second) + "\",phase=\"" + phase_names[i % phase_cnt] +
+           "\"";
+  }
+
+  static std::string escape(const std::string& value) {
+    std::string out;
+    for (char ch : value) {
+      if (ch == '\\' || ch == '"')
+        out += '\\';
+      else if (ch == '\n') {
+        out += "\\n";
+        continue;
+      }
+      out += ch;
+    }
+    return out;
+  }
+};
+
+#endif  // !_METRICS_HPP_
@@ -0,0 +1,95 @@
+#ifndef _PAGE_CACHE_HPP_
+#define _PAGE_CACHE_HPP_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "ranking.hpp"
+
+// Pre-rendered leaderboard page bodies, keyed by (index, offset, count).
+//
+// A page remembers the Ranking write version it was rendered at and stays
+// valid until a write lands inside its rank window, which Ranking reports
+// through last_write_above without taking its lock. A hit costs one map
+// lookup and hands out the same immutable bytes to every connection.
+//
+// Only windows inside the top max_rank ranks are cached, deeper pages are
+// rarely asked for twice.
+class PageCache {
+ public:
+  typedef std::shared_ptr<const std::string> page_t;
+
+  PageCache(Ranking &rank_, uint32_t max_rank_ = 1000,
+            size_t max_pages_ = 1024)
+      : rank(rank_), max_rank(max_rank_), max_pages(max_pages_) {
+    // a replica reads the stamps of the owner, it leaves the segment alone
+    if (!rank.is_replica()) rank.track_writes();
+  }
+
+  // render(view, out) writes the body of the page; it runs under the
+  // Ranking read lock. Returns nullptr for windows that are not cached, and
+  // for all of them while nobody stamps the writes.
+  template <typename Tag, typename Render>
+  page_t get(uint32_t offset, uint32_t count, Render &&render) {
+    if (!count || offset >= max_rank || count > max_rank - offset ||
+        !rank.tracks_writes())
+      return nullptr;
+    uint32_t end = offset + count;
+    uint64_t key = make_key(rank_index_id<Tag>(), offset, count);
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      auto it = pages.find(key);
+      if (it != pages.end() &&
+          rank.last_write_above<Tag>(end) <= it->second.version) {
+        hits++;
+        return it->second.bytes;
+      }
+    }
+
+    Page page;
+    std::ostringstream out;
+    rank.read_batch([&](Ranking::View &view) {
+      page.version = view.version();
+      render(view, out);
+    });
+    page.bytes = std::make_shared<const std::string>(out.str());
+
+    std::lock_guard<std::mutex> lock(mtx);
+    misses++;
+    if (pages.size() >= max_pages && !pages.count(key)) pages.clear();
+    // keep whichever render saw the later state
+    auto &slot = pages[key];
+    if (!slot.bytes || slot.version < page.version) slot = page;
+    return page.bytes;
+  }
+
+  uint64_t get_hits() const { return hits; }
+  uint64_t get_misses() const { return misses; }
+
+ private:
+  struct Page {
+    uint64_t version = 0;
+    page_t bytes;
+  };
+
+  Ranking &rank;
+  const uint32_t max_rank;
+  const size_t max_pages;
+  std::mutex mtx;
+  std::unordered_map<uint64_t, Page> pages;
+  std::atomic<uint64_t> hits{0}, misses{0};
+
+  static uint64_t make_key(int index, uint32_t offset, uint32_t count) {
+    return (static_cast<uint64_t>(index) << 56) |
+           (static_cast<uint64_t>(offset) << 24) | count;
+  }
+};
+
+#endif  // !_PAGE_CACHE_HPP_
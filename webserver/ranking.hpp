@@ -6,8 +6,15 @@
 #include <stdint.h>
 
 #include <boost/interprocess/allocators/allocator.hpp>
-#include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/managed_external_buffer.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/mem_algo/rbtree_best_fit.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_sharable_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/global_fun.hpp>
 #include <boost/multi_index/indexed_by.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/member.hpp>
@@ -15,165 +22,1347 @@
 #include <boost/multi_index/random_access_index.hpp>
 #include <boost/multi_index/ranked_index.hpp>
 #include <boost/multi_index_container.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
 #include <boost/range/irange.hpp>
+#include <boost/utility/string_view.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <initializer_list>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compact_string.hpp"
 #include "exception.hpp"
+#include "schema.hpp"
+
+// rbtree_best_fit that can grow while other threads allocate from it.
+//
+// The stock grow() links the new space into the free tree without taking the
+// allocator's mutex, so every entry point here holds a sharable lock and
+// grow() holds it exclusively. The lock lives in the segment header, behind
+// the base algorithm's own header bytes, next to a count of the allocations
+// served.
+template <class MutexFamily,
+          class VoidPointer = boost::interprocess::offset_ptr<void>>
+class growable_best_fit
+    : public boost::interprocess::rbtree_best_fit<MutexFamily, VoidPointer> {
+  typedef boost::interprocess::rbtree_best_fit<MutexFamily, VoidPointer>
+      base_t;
+  typedef boost::interprocess::sharable_lock<
+      boost::interprocess::interprocess_sharable_mutex>
+      shared_t;
+  typedef boost::interprocess::scoped_lock<
+      boost::interprocess::interprocess_sharable_mutex>
+      exclusive_t;
+
+  boost::interprocess::interprocess_sharable_mutex grow_mtx;
+  std::atomic<uint64_t> allocations{0};
+
+ public:
+  typedef typename base_t::size_type size_type;
+  typedef typename base_t::multiallocation_chain multiallocation_chain;
+
+  growable_best_fit(size_type size, size_type extra_hdr_bytes)
+      : base_t(size, extra_hdr_bytes + own_size()) {}
+
+  static size_type get_min_size(size_type extra_hdr_bytes) {
+    return base_t::get_min_size(extra_hdr_bytes + own_size());
+  }
+
+  void *allocate(size_type nbytes) {
+    shared_t lock(grow_mtx);
+    count();
+    return base_t::allocate(nbytes);
+  }
+
+  void *allocate_aligned(size_type nbytes, size_type alignment) {
+    shared_t lock(grow_mtx);
+    count();
+    return base_t::allocate_aligned(nbytes, alignment);
+  }
+
+  void allocate_many(size_type elem_bytes, size_type num_elements,
+                     multiallocation_chain &chain) {
+    shared_t lock(grow_mtx);
+    count(num_elements);
+    base_t::allocate_many(elem_bytes, num_elements, chain);
+  }
+
+  void allocate_many(const size_type *elem_sizes, size_type n_elements,
+                     size_type sizeof_element, multiallocation_chain &chain) {
+    shared_t lock(grow_mtx);
+    count(n_elements);
+    base_t::allocate_many(elem_sizes, n_elements, sizeof_element, chain);
+  }
 
-typedef boost::interprocess::managed_shared_memory::allocator<char>::type
-    char_allocator;
-typedef boost::interprocess::basic_string<char, std::char_traits<char>,
-                                          char_allocator>
-    shm_string;
+  void deallocate_many(multiallocation_chain &chain) {
+    shared_t lock(grow_mtx);
+    base_t::deallocate_many(chain);
+  }
+
+  void deallocate(void *addr) {
+    shared_t lock(grow_mtx);
+    base_t::deallocate(addr);
+  }
+
+  template <class T>
+  T *allocation_command(boost::interprocess::allocation_type command,
+                        size_type limit_size,
+                        size_type &prefer_in_recvd_out_size, T *&reuse) {
+    shared_t lock(grow_mtx);
+    count();
+    return base_t::allocation_command(command, limit_size,
+                                      prefer_in_recvd_out_size, reuse);
+  }
+
+  void *raw_allocation_command(boost::interprocess::allocation_type command,
+                               size_type limit_object,
+                               size_type &prefer_in_recvd_out_size,
+                               void *&reuse_ptr, size_type sizeof_object = 1) {
+    shared_t lock(grow_mtx);
+    count();
+    return base_t::raw_allocation_command(command, limit_object,
+                                          prefer_in_recvd_out_size, reuse_ptr,
+                                          sizeof_object);
+  }
+
+  // allocations served since the segment was created
+  uint64_t get_allocations() const {
+    return allocations.load(std::memory_order_relaxed);
+  }
+
+  void grow(size_type extra_size) {
+    exclusive_t lock(grow_mtx);
+    base_t::grow(extra_size);
+  }
+
+  void shrink_to_fit() {
+    exclusive_t lock(grow_mtx);
+    base_t::shrink_to_fit();
+  }
+
+ private:
+  void count(size_type n = 1) {
+    allocations.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // header bytes the base algorithm must leave alone
+  static constexpr size_type own_size() {
+    return sizeof(growable_best_fit) - sizeof(base_t);
+  }
+};
+
+// The segment is managed in place over a mapping Ranking sets up itself,
+// of POSIX shared memory or of a data file, so it can extend that mapping.
+typedef boost::interprocess::basic_managed_external_buffer<
+    char, growable_best_fit<boost::interprocess::mutex_family>,
+    boost::interprocess::iset_index>
+    segment_t;
+typedef segment_t::segment_manager segment_manager_t;
+
+typedef segment_manager_t::allocator<char>::type char_allocator;
+typedef CompactString<char_allocator> shm_string;
 
 struct User {
   uint32_t uid;
   shm_string name;
-  uint32_t exp_pers;
-  uint32_t activity;
-
-  User(const char_allocator &a) : name("", a) {}
-  User(uint32_t uid_, uint32_t exp_pers_, uint32_t activity_, const char *name_,
-       const char_allocator &a)
-      : uid(uid_), name(name_, a), exp_pers(exp_pers_), activity(activity_) {}
+  // the stored scores, in score_fields order
+  scores_t scores = {};
+  // hybrid_index key, kept up to date by Ranking on every write
+  uint64_t hybrid = 0;
 
-  uint32_t by_exp_pers() const { return exp_pers; }
-  uint32_t by_hybrid() const { return exp_pers * 0.7 + activity * 0.3; }
+  User(const char_allocator &a) : name(a) {}
+  User(uint32_t uid_, const scores_t &scores_, boost::string_view name_,
+       const char_allocator &a, uint64_t hybrid_ = 0)
+      : uid(uid_), name(name_, a), scores(scores_), hybrid(hybrid_) {}
 
-  void assign(boost::property_tree::ptree::iterator iter, char_allocator &ca) {
-    uid = (iter++)->second.get_value<uint32_t>();
-    name = shm_string((iter++)->second.get_value<std::string>().c_str(), ca);
-    exp_pers = (iter++)->second.get_value<uint32_t>();
-    activity = (iter++)->second.get_value<uint32_t>();
+  template <typename Tag>
+  uint32_t &score() {
+    return scores[score_field_id<Tag>()];
+  }
+  template <typename Tag>
+  uint32_t score() const {
+    return scores[score_field_id<Tag>()];
   }
 
   bool operator<(const User &user) const { return uid < user.uid; }
 
-  friend std::ostream &operator<<(std::ostream &os, shm_string &str) {
-    for (auto ch : str) os << static_cast<char>(ch);
-    return os;
-  }
-
   friend std::ostream &operator<<(std::ostream &out, const User &user) {
-    out << "User: " << user.uid << "\tname: " << user.name
-        << "\texp_pers: " << user.exp_pers << "\tactivity: " << user.activity
-        << std::endl;
+    out << "User: " << user.uid << "\tname: " << user.name;
+    score_fields::for_each([&](auto tag) {
+      out << "\t" << score_field_traits<decltype(tag)>::name() << ": "
+          << user.score<decltype(tag)>();
+    });
+    out << std::endl;
     return out;
   }
 };
 
+// Fixed-point weights of the hybrid score, in thousandths, one per stored
+// score in score_fields order:
+//   hybrid = exp_pers * 700 + activity * 300
+// 700/300 ranks like the old exp_pers * 0.7 + activity * 0.3, without the
+// float conversions and without truncating close scores into ties. A score
+// added without a weight stays out of the hybrid.
+struct HybridWeights {
+  std::array<uint32_t, score_field_cnt> w = {{700, 300}};
+
+  uint64_t operator()(const scores_t &scores) const {
+    uint64_t hybrid = 0;
+    for (int i = 0; i < score_field_cnt; i++)
+      hybrid += static_cast<uint64_t>(scores[i]) * w[i];
+    return hybrid;
+  }
+
+  uint64_t operator()(const User &user) const { return (*this)(user.scores); }
+
+  bool operator==(const HybridWeights &other) const { return w == other.w; }
+};
+
 struct tag_uid {};
-struct tag_exp_pers {};
-struct tag_activity {};
 struct tag_hybrid {};
 
+// Per ranked index: the name it goes by in queries and routes, the label of
+// its single-rank answer and the score it orders by. A stored score orders
+// by itself.
+template <typename Tag>
+struct rank_index_traits : score_field_traits<Tag> {
+  typedef uint32_t score_t;
+  static score_t score(const User &user) { return user.score<Tag>(); }
+};
+template <>
+struct rank_index_traits<tag_hybrid> {
+  static constexpr const char *name() { return "hybrid"; }
+  static constexpr const char *label() { return "Hybrid"; }
+  typedef uint64_t score_t;
+  static score_t score(const User &user) { return user.hybrid; }
+};
+
+// The ranked indices: the stored scores of schema.hpp, then the hybrid.
+// Everything per index is generated from here and rank_index_traits: the
+// container, the dense score sets, the rank accessors, /top and the
+// /get_<name> and /ranks routes.
+typedef score_fields::append<tag_hybrid> rank_indices;
+constexpr int rank_index_cnt = rank_indices::size;
+
+template <typename Tag>
+constexpr int rank_index_id() {
+  return rank_index_pos<Tag, rank_indices>::value;
+}
+
+// Ranked indices order by (score desc, uid asc): ties have a fixed order,
+// which is what the ordinal rank reports, and a partial (score) key still
+// finds the first user with that score for the competition rank.
+template <typename Tag>
+struct ranked_index_of {
+  typedef typename rank_index_traits<Tag>::score_t score_t;
+  typedef boost::multi_index::ranked_unique<
+      boost::multi_index::tag<Tag>,
+      boost::multi_index::composite_key<
+          User,
+          boost::multi_index::global_fun<const User &, score_t,
+                                         &rank_index_traits<Tag>::score>,
+          boost::multi_index::member<User, uint32_t, &User::uid>>,
+      boost::multi_index::composite_key_compare<std::greater<score_t>,
+                                                std::less<uint32_t>>>
+      type;
+};
+
+// the ranked indices in list order, then the uid index
+template <typename List>
+struct container_of;
+template <typename... Tags>
+struct container_of<rank_index_list<Tags...>> {
+  typedef boost::multi_index_container<
+      User,
+      boost::multi_index::indexed_by<
+          typename ranked_index_of<Tags>::type...,
+          boost::multi_index::ordered_unique<
+              boost::multi_index::tag<tag_uid>,
+              boost::multi_index::member<User, uint32_t, &User::uid>>>,
+      segment_manager_t::allocator<User>::type>
+      type;
+};
+typedef container_of<rank_indices>::type container_t;
+
+typedef container_t::index<tag_uid>::type uid_index_t;
+
+// Sets of ranked indices, one bit per id.
+template <typename Tag>
+constexpr unsigned rank_index_bit() {
+  return 1u << rank_index_id<Tag>();
+}
+constexpr unsigned all_rank_indices = (1u << rank_index_cnt) - 1;
+
+// Ranked indices of the set whose score differs between a and b.
+inline unsigned moved_indices(const User &a, const User &b) {
+  unsigned moved = 0;
+  rank_indices::for_each([&](auto tag) {
+    typedef rank_index_traits<decltype(tag)> traits;
+    if (traits::score(a) != traits::score(b))
+      moved |= rank_index_bit<decltype(tag)>();
+  });
+  return moved;
+}
+
+// How users with equal scores are ranked, all 0-based:
+//   competition  users with a strictly greater score (1224 style)
+//   dense        distinct scores strictly greater (1223 style)
+//   ordinal      position in the index, equal scores ordered by uid
+enum class rank_mode { competition, dense, ordinal };
+
+// Distinct scores of one ranked index with their user counts, kept only in
+// dense mode: the rank of a score here is its dense rank.
+struct ScoreCount {
+  uint64_t score;
+  uint32_t cnt;
+};
+
 typedef boost::multi_index_container<
-    User,
+    ScoreCount,
+    boost::multi_index::indexed_by<boost::multi_index::ranked_unique<
+        boost::multi_index::member<ScoreCount, uint64_t, &ScoreCount::score>,
+        std::greater<uint64_t>>>,
+    segment_manager_t::allocator<ScoreCount>::type>
+    score_set_t;
+
+// Calls f(tag) for the ranked index called name, false if there is none.
+template <typename Func>
+bool with_rank_index(boost::string_view name, Func &&f) {
+  bool found = false;
+  rank_indices::for_each([&](auto tag) {
+    if (!found && name == rank_index_traits<decltype(tag)>::name()) {
+      found = true;
+      f(tag);
+    }
+  });
+  return found;
+}
+
+// Activity boards over windows of time, for "most active this week".
+//
+// A window is a number that only grows; what it spans is up to whoever
+// starts the next one. A user's score in a window is the activity it gained
+// during the window, decreases don't count. A new user starts without any:
+// the activity it is put with was not gained in the window. Windows
+// alternate between two boards by parity, and an entry is stamped with the
+// window it was last scored in: the board of window w ranks (window desc,
+// score desc, uid asc), so the entries of w come first and the stale ones of
+// w - 2 or earlier sort after them, out of every rank and range. Starting a
+// window is only bumping the number; a stale entry is reset by its user's
+// next gain.
+//
+// The current window is tag_this_window, the one before tag_last_window.
+// Ranks are competition ranks whatever the rank_mode, and a user without
+// activity in the window ranks after everyone with some.
+template <int Ago>
+struct tag_window {};
+typedef tag_window<0> tag_this_window;
+typedef tag_window<1> tag_last_window;
+
+struct WindowScore {
+  uint32_t uid;
+  uint32_t window;
+  uint32_t score;
+};
+
+typedef boost::multi_index_container<
+    WindowScore,
     boost::multi_index::indexed_by<
-        boost::multi_index::ranked_non_unique<
-            boost::multi_index::tag<tag_exp_pers>,
-            boost::multi_index::const_mem_fun<User, uint32_t,
-                                              &User::by_exp_pers>,
-            std::greater<uint32_t>>,
-        boost::multi_index::ranked_non_unique<
-            boost::multi_index::tag<tag_activity>,
-            boost::multi_index::member<User, uint32_t, &User::activity>,
-            std::greater<uint32_t>>,
-        boost::multi_index::ranked_non_unique<
-            boost::multi_index::tag<tag_hybrid>,
-            boost::multi_index::const_mem_fun<User, uint32_t, &User::by_hybrid>,
-            std::greater<uint32_t>>,
         boost::multi_index::ordered_unique<
             boost::multi_index::tag<tag_uid>,
-            boost::multi_index::member<User, uint32_t, &User::uid>>>,
-    boost::interprocess::managed_shared_memory::allocator<User>::type>
+            boost::multi_index::member<WindowScore, uint32_t,
+                                       &WindowScore::uid>>,
+        boost::multi_index::ranked_unique<
+            boost::multi_index::tag<tag_activity>,
+            boost::multi_index::composite_key<
+                WindowScore,
+                boost::multi_index::member<WindowScore, uint32_t,
+                                           &WindowScore::window>,
+                boost::multi_index::member<WindowScore, uint32_t,
+                                           &WindowScore::score>,
+                boost::multi_index::member<WindowScore, uint32_t,
+                                           &WindowScore::uid>>,
+            boost::multi_index::composite_key_compare<
+                std::greater<uint32_t>, std::greater<uint32_t>,
+                std::less<uint32_t>>>>,
+    segment_manager_t::allocator<WindowScore>::type>
+    window_board_t;
 
-    container_t;
+struct WindowState {
+  bool tracking = false;
+  uint32_t current = 0;
+};
 
-typedef container_t::index<tag_uid>::type uid_index_t;
-typedef container_t::index<tag_exp_pers>::type exp_pers_index_t;
-typedef container_t::index<tag_activity>::type activity_index_t;
-typedef container_t::index<tag_hybrid>::type hybrid_index_t;
+// Ranks of one user on the ranked indices a batch query asked for, by
+// rank_index_id<Tag>(); the rest are left alone.
+struct UserRanks {
+  uint32_t uid;
+  bool found;
+  uint32_t ranks[rank_index_cnt];
+};
+
+// Lives next to the container in the segment: a process-shared mutex is the
+// only kind that stays valid there. Rank queries share it, writes own it.
+typedef boost::interprocess::interprocess_sharable_mutex rank_mutex_t;
+typedef boost::interprocess::sharable_lock<rank_mutex_t> read_lock_t;
+typedef boost::interprocess::scoped_lock<rank_mutex_t> write_lock_t;
+
+// Segment usage; size grows by doubling up to reserved.
+struct SegmentStats {
+  uint64_t size;
+  uint64_t free;
+  uint64_t reserved;
+  uint32_t grows;
+  // allocations served by the segment since it was created
+  uint64_t allocations;
+};
+
+// What the derived state in a segment was built with: the hybrid keys
+// depend on the weights, the distinct score sets on the rank mode.
+struct SegmentMeta {
+  rank_mode mode;
+  HybridWeights weights;
+};
+
+// Write tracking for caches layered on top, off until track_writes(); kept in
+// the segment so caches in replica processes see the owner's writes.
+// Every write bumps version (under the write lock) and stamps it on the rank
+// bucket it landed in, for each ranked index. Bucket b holds ranks
+// [2^b - 1, 2^(b+1) - 1), so "did anything above rank n change" is a scan of
+// at most 33 stamps and needs no lock.
+constexpr int rank_bucket_cnt = 33;
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "stamps are shared between processes");
+struct WriteStamps {
+  std::atomic<bool> tracking{false};
+  uint64_t version = 0;
+  std::atomic<uint64_t> touched[rank_index_cnt][rank_bucket_cnt] = {};
+};
+
+// Who maps the segment. The owner rebuilds the lock of a segment it reopens,
+// which a crash may have left held, so it refuses while a replica that may
+// be holding or waiting on it is alive. generation moves whenever an owner
+// takes the segment over or leaves it; a replica checks it after every read
+// lock and fails its queries once it moved. Pids of processes that died are
+// free slots.
+constexpr int max_replicas = 64;
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "pids are shared between processes");
+struct SegmentOwner {
+  std::atomic<uint64_t> generation{0};
+  std::atomic<int32_t> pid{0};
+  std::atomic<int32_t> replicas[max_replicas] = {};
+};
 
 class Ranking {
  private:
   container_t *users;
   uid_index_t *uid_index;
-  exp_pers_index_t *exp_pers_index;
-  activity_index_t *activity_index;
-  hybrid_index_t *hybrid_index;
+  rank_mutex_t *mtx;
+
+  WriteStamps *stamps;
+
+  SegmentOwner *owner;
+  // a replica's slot in owner->replicas, and the generation it attached to
+  std::atomic<int32_t> *slot = nullptr;
+  uint64_t generation = 0;
+
+  static bool alive(int32_t pid) {
+    return pid && (::kill(pid, 0) == 0 || errno == EPERM);
+  }
+
+  static int rank_bucket(uint32_t rank) {
+    return 63 - __builtin_clzll(static_cast<uint64_t>(rank) + 1);
+  }
+
+  template <typename Tag, typename Iter>
+  void stamp(Iter it) {
+    auto &index = boost::get<Tag>(*users);
+    uint32_t r = index.rank(users->project<Tag>(it));
+    stamps->touched[rank_index_id<Tag>()][rank_bucket(r)].store(
+        stamps->version, std::memory_order_release);
+  }
+
+  // stamps the position of it in each index of the set
+  template <typename Iter>
+  void stamp(Iter it, unsigned indices = all_rank_indices) {
+    if (!stamps->tracking) return;
+    rank_indices::for_each([&](auto tag) {
+      if (indices & rank_index_bit<decltype(tag)>()) stamp<decltype(tag)>(it);
+    });
+  }
+
+  // taken from the segment by replicas
+  HybridWeights weights;
+
+  // tie semantics, distinct score sets are only maintained in dense mode
+  rank_mode mode;
+  score_set_t *distinct[rank_index_cnt];
+
+  WindowState *windows;
+  // the board of window w is boards[w % 2]
+  window_board_t *boards[2];
+
+  // activity going from before to after in the current window
+  void gain(uint32_t uid, uint32_t before, uint32_t after) {
+    if (!windows->tracking || after <= before) return;
+    uint32_t w = windows->current, delta = after - before;
+    auto &board = *boards[w % 2];
+    auto it = board.find(uid);
+    if (it == board.end()) {
+      board.insert(WindowScore{uid, w, delta});
+      return;
+    }
+    board.modify(it, [w, delta](WindowScore &entry) {
+      if (entry.window != w) entry = WindowScore{entry.uid, w, 0};
+      entry.score =
+          delta > UINT32_MAX - entry.score ? UINT32_MAX : entry.score + delta;
+    });
+  }
+
+  void forget_windows(uint32_t uid) {
+    for (auto board : boards) board->erase(uid);
+  }
+
+  // window ago windows back, false before the first window
+  bool window_of(uint32_t ago, uint32_t &w) const {
+    if (ago > windows->current) return false;
+    w = windows->current - ago;
+    return true;
+  }
+
+  // uid's score in window w, 0 without activity in it
+  uint32_t window_score(uint32_t w, uint32_t uid) const {
+    auto &board = *boards[w % 2];
+    auto it = board.find(uid);
+    return it != board.end() && it->window == w ? it->score : 0;
+  }
+
+  template <typename Tag, typename Iter>
+  uint32_t rank_on(Tag, Iter it) const {
+    return rank_of<Tag>(it);
+  }
+
+  template <int Ago, typename Iter>
+  uint32_t rank_on(tag_window<Ago>, Iter it) const {
+    uint32_t w;
+    if (!window_of(Ago, w)) return 0;
+    return boost::get<tag_activity>(*boards[w % 2])
+        .lower_bound_rank(boost::make_tuple(w, window_score(w, it->uid)));
+  }
+
+  template <typename Tag>
+  void count_score(const User &user, int delta) {
+    auto &scores = *distinct[rank_index_id<Tag>()];
+    uint64_t score = rank_index_traits<Tag>::score(user);
+    auto it = scores.find(score);
+    if (it == scores.end()) {
+      scores.insert(ScoreCount{score, 1});
+    } else if (it->cnt + delta == 0) {
+      scores.erase(it);
+    } else {
+      scores.modify(it, [delta](ScoreCount &sc) { sc.cnt += delta; });
+    }
+  }
+
+  // delta is +1 for a user entering the indices of the set, -1 for one
+  // leaving
+  void count_scores(const User &user, int delta,
+                    unsigned indices = all_rank_indices) {
+    if (mode != rank_mode::dense) return;
+    rank_indices::for_each([&](auto tag) {
+      if (indices & rank_index_bit<decltype(tag)>())
+        count_score<decltype(tag)>(user, delta);
+    });
+  }
+
+  // bookkeeping for a user that made it into the container
+  template <typename Iter>
+  bool inserted(std::pair<Iter, bool> res) {
+    if (!res.second) return false;
+    count_scores(*res.first, 1);
+    stamps->version++;
+    stamp(res.first);
+    return true;
+  }
+
+  static constexpr size_t ranks_per_thread = 1 << 12;
+
+  void fill_ranks(UserRanks &r, unsigned indices) const {
+    auto it = uid_index->find(r.uid);
+    r.found = it != uid_index->end();
+    if (!r.found) return;
+    rank_indices::for_each([&](auto tag) {
+      typedef decltype(tag) tag_t;
+      if (indices & rank_index_bit<tag_t>())
+        r.ranks[rank_index_id<tag_t>()] = rank_of<tag_t>(it);
+    });
+  }
+
+  template <typename Tag, typename Iter>
+  uint32_t rank_of(Iter it) const {
+    auto &index = boost::get<Tag>(*users);
+    auto score = rank_index_traits<Tag>::score(*it);
+    switch (mode) {
+      case rank_mode::dense:
+        return distinct[rank_index_id<Tag>()]->find_rank(score);
+      case rank_mode::ordinal:
+        return index.rank(users->project<Tag>(it));
+      case rank_mode::competition:
+      default:
+        return index.lower_bound_rank(boost::make_tuple(score));
+    }
+  }
 
-  // interprocess
-  boost::interprocess::managed_shared_memory *segment;
+  // interprocess: anonymous shared memory, or a file that outlives the
+  // process when Ranking is given a path
+  const std::string path;
+  // a replica maps a segment another process owns and only reads it
+  const bool replica;
+  boost::interprocess::shared_memory_object shm;
+  int fd = -1;
+  std::unique_ptr<segment_t> managed;
+  segment_manager_t *segment;
+  SegmentMeta *meta;
   char_allocator *ca_ptr;
+
+  // The segment is mapped at the start of a reserved address range and grows
+  // into it, so it never moves: the index pointers from init_index(), the
+  // mutex and any reference into the segment stay valid across growth.
+  static constexpr uint64_t max_segment_size = 1ull << 36;
+  // generous upper bound on what one write allocates besides the name
+  static constexpr uint64_t write_bytes = 1024;
+  // users bulk_put inserts per write lock
+  static constexpr ptrdiff_t bulk_block = 1 << 16;
+  char *base = nullptr;
+  std::atomic<uint64_t> mapped{0};
+  uint64_t reserved = 0;
+  uint32_t grows = 0;
+  std::mutex follow_mtx;
+
+  // Opens the backing object and returns its current size, 0 if the owner
+  // has just created it.
+  uint64_t open_backing() {
+    if (path.empty()) {
+      if (replica)
+        shm = boost::interprocess::shared_memory_object(
+            boost::interprocess::open_only, "MySharedMemory",
+            boost::interprocess::read_write);
+      else
+        shm = boost::interprocess::shared_memory_object(
+            boost::interprocess::create_only, "MySharedMemory",
+            boost::interprocess::read_write);
+      fd = shm.get_mapping_handle().handle;
+    } else {
+      fd = ::open(path.c_str(), replica ? O_RDWR : O_RDWR | O_CREAT, 0644);
+      if (fd < 0) throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+      throw std::runtime_error("cannot stat the segment");
+    return st.st_size;
+  }
+
+  // Maps the first size bytes of the backing object at the start of a fresh
+  // reservation, or on its own if no address space can be reserved, in which
+  // case the segment cannot grow.
+  void map_backing(uint64_t size) {
+    uint64_t len = size > max_segment_size ? size : max_segment_size;
+    void *addr = ::mmap(nullptr, len, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr != MAP_FAILED) {
+      base = static_cast<char *>(addr);
+      reserved = len;
+      if (map_tail(size)) return;
+      ::munmap(base, reserved);
+      throw std::bad_alloc();
+    }
+    addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) throw std::bad_alloc();
+    base = static_cast<char *>(addr);
+    mapped = size;
+  }
+
+  // Extends the backing object by extra bytes and maps them right behind
+  // what is mapped already, over the reserved range. Replicas map what the
+  // owner has already extended.
+  bool map_tail(uint64_t extra) {
+    if (!replica && ::ftruncate(fd, mapped + extra) != 0) return false;
+    if (::mmap(base + mapped, extra, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, mapped) != base + mapped)
+      return false;
+    mapped += extra;
+    return true;
+  }
+
+  // Keeps bytes plus an eighth of the segment free, doubling the segment in
+  // place when it runs low; the headroom covers names allocated outside the
+  // lock by callers building Users. Runs under the write lock, so readers
+  // wait for one ftruncate and one mmap, and nothing is copied. When the
+  // reservation is used up the allocation itself reports bad_alloc.
+  void reserve_free(uint64_t bytes) {
+    uint64_t size = segment->get_size();
+    if (segment->get_free_memory() >= bytes + size / 8) return;
+    uint64_t page = boost::interprocess::mapped_region::get_page_size();
+    uint64_t extra =
+        (std::max(mapped.load(), bytes + size / 8) + page - 1) / page * page;
+    extra = std::min(extra, reserved > mapped ? reserved - mapped : 0);
+    if (extra < bytes || !map_tail(extra)) return;
+    managed->grow(extra);
+    grows++;
+  }
+
   std::string mem_obj = "MySharedMemory";
   struct shm_remove {
-    shm_remove() {
-      boost::interprocess::shared_memory_object::remove("MySharedMemory");
+    const bool owned;
+    explicit shm_remove(bool owned_) : owned(owned_) {
+      if (owned) retire_shm();
     }
     ~shm_remove() {
-      boost::interprocess::shared_memory_object::remove("MySharedMemory");
+      if (owned)
+        boost::interprocess::shared_memory_object::remove("MySharedMemory");
     }
   } remover;
 
+  // Replicas only look segment objects up, the owner creates missing ones.
+  template <typename T, typename... Args>
+  T *named(const char *name, Args &&... args) {
+    if (!replica)
+      return segment->find_or_construct<T>(name)(std::forward<Args>(args)...);
+    T *obj = segment->find<T>(name).first;
+    if (!obj) throw std::runtime_error(std::string("segment lacks ") + name);
+    return obj;
+  }
+
+  void open_segment(bool reopened) {
+    if (reopened)
+      managed.reset(
+          new segment_t(boost::interprocess::open_only, base, mapped));
+    else
+      managed.reset(
+          new segment_t(boost::interprocess::create_only, base, mapped));
+    segment = managed->get_segment_manager();
+
+    users = named<container_t>("My MultiIndex Container",
+                               container_t::ctor_args_list(),
+                               segment->get_allocator<User>());
+
+    mtx = named<rank_mutex_t>("My MultiIndex Mutex");
+
+    rank_indices::for_each([this](auto tag) {
+      typedef decltype(tag) tag_t;
+      std::string name =
+          std::string("Distinct ") + rank_index_traits<tag_t>::name();
+      distinct[rank_index_id<tag_t>()] = named<score_set_t>(
+          name.c_str(), score_set_t::ctor_args_list(),
+          segment->get_allocator<ScoreCount>());
+    });
+
+    meta = named<SegmentMeta>("My Ranking Meta", SegmentMeta{mode, weights});
+    stamps = named<WriteStamps>("My Write Stamps");
+    owner = named<SegmentOwner>("My Segment Owner");
+    windows = named<WindowState>("My Windows");
+    for (int i = 0; i < 2; i++)
+      boards[i] = named<window_board_t>(
+          i ? "My Window Board 1" : "My Window Board 0",
+          window_board_t::ctor_args_list(),
+          segment->get_allocator<WindowScore>());
+
+    ca_ptr = new char_allocator(segment->get_allocator<char>());
+
+    init_index();
+  }
+
+  // Takes the read lock. A replica first catches its mapping up with a
+  // segment the owner has grown, which cannot happen again while the lock
+  // is held.
+  read_lock_t lock_shared() {
+    read_lock_t lock(*mtx);
+    if (replica && owner->generation.load() != generation)
+      throw std::runtime_error("the owner left or took the segment over");
+    if (replica && segment->get_size() > mapped) {
+      std::lock_guard<std::mutex> guard(follow_mtx);
+      uint64_t size = segment->get_size();
+      if (size > mapped && (size > reserved || !map_tail(size - mapped)))
+        throw std::runtime_error("replica cannot map the grown segment");
+    }
+    return lock;
+  }
+
+  write_lock_t lock_exclusive() {
+    if (replica) throw std::logic_error("writes go to the owning process");
+    return write_lock_t(*mtx);
+  }
+
   void init_index() {
     uid_index = &boost::get<tag_uid>(*users);
-    exp_pers_index = &boost::get<tag_exp_pers>(*users);
-    activity_index = &boost::get<tag_activity>(*users);
-    hybrid_index = &boost::get<tag_hybrid>(*users);
+  }
+
+  // Makes this process the owner, rebuilding the lock of a reopened segment
+  // unless another process may still use it. Replicas attaching meanwhile
+  // see no live owner until the lock is rebuilt, and give up.
+  void claim(bool reopened) {
+    if (alive(owner->pid.load()))
+      throw std::runtime_error("the segment already has an owner");
+    for (auto &s : owner->replicas)
+      if (alive(s.load()))
+        throw std::runtime_error("a replica still maps the segment");
+    if (reopened) new (mtx) rank_mutex_t();
+    owner->generation++;
+    owner->pid = ::getpid();
+  }
+
+  // Takes a replica slot, then checks for a live owner: a claim racing with
+  // it either sees the slot or has already rebuilt the lock.
+  void attach() {
+    int32_t self = ::getpid();
+    for (auto &s : owner->replicas) {
+      int32_t pid = s.load();
+      if (!alive(pid) && s.compare_exchange_strong(pid, self)) {
+        slot = &s;
+        break;
+      }
+    }
+    if (!slot) throw std::runtime_error("too many replicas");
+    if (!alive(owner->pid.load())) {
+      detach();
+      throw std::runtime_error("the segment has no owner");
+    }
+    generation = owner->generation.load();
+  }
+
+  void detach() {
+    if (slot) slot->store(0);
+    slot = nullptr;
+  }
+
+  // The shared memory a previous owner left behind, when it crashed: its
+  // replicas are told it is gone before the name is reused. A live owner
+  // keeps it.
+  static void retire_shm() {
+    using namespace boost::interprocess;
+    try {
+      shared_memory_object old(open_only, "MySharedMemory", read_write);
+      mapped_region region(old, read_write);
+      segment_t segment(open_only, region.get_address(), region.get_size());
+      auto gone = segment.find<SegmentOwner>("My Segment Owner").first;
+      if (gone && alive(gone->pid.load()))
+        throw std::runtime_error("the segment already has an owner");
+      if (gone) gone->generation++;
+    } catch (const interprocess_exception &) {
+      // none, or not a segment
+    }
+    shared_memory_object::remove("MySharedMemory");
+  }
+
+  // Brings the derived state of a reopened file in line with this
+  // instance's weights and rank mode, which only costs a pass over the users
+  // when they differ from what the file was written with.
+  void reattach() {
+    bool reweigh = !(meta->weights == weights);
+    if (reweigh)
+      for (auto it = uid_index->begin(); it != uid_index->end(); ++it)
+        uid_index->modify(
+            it, [this](User &user) { user.hybrid = weights(user); });
+
+    if (mode != meta->mode || reweigh) {
+      reserve_free(users->size() * write_bytes / 4);
+      for (auto scores : distinct) scores->clear();
+      for (auto &user : *users) count_scores(user, 1);
+    }
+    *meta = SegmentMeta{mode, weights};
   }
 
  public:
-  Ranking(uint64_t mem_size = 1 << 20) {
-    segment = new boost::interprocess::managed_shared_memory(
-        boost::interprocess::create_only, "MySharedMemory", mem_size);
+  // With a path the segment lives in that file, reopened with its users if
+  // the file exists (mem_size is ignored then) and created otherwise. Either
+  // way mem_size is only the starting size, the segment grows as needed.
+  Ranking(uint64_t mem_size = 1 << 20,
+          rank_mode mode_ = rank_mode::competition,
+          HybridWeights weights_ = HybridWeights(),
+          const std::string &path_ = "")
+      : weights(weights_),
+        mode(mode_),
+        path(path_),
+        replica(false),
+        remover(path_.empty()) {
+    uint64_t page = boost::interprocess::mapped_region::get_page_size();
+    uint64_t size = open_backing();
+    bool reopened = size != 0;
+    if (!reopened) size = (mem_size + page - 1) / page * page;
+    map_backing(size);
+    open_segment(reopened);
+    claim(reopened);
+    if (reopened) reattach();
+  }
 
-    users = segment->construct<container_t>("My MultiIndex Container")(
-        container_t::ctor_args_list(), segment->get_allocator<User>());
+  // A read replica of the Ranking another process owns, in shared memory or
+  // in path. It answers queries with the owner's rank mode and weights and
+  // follows the segment as it grows; writes throw std::logic_error. Start it
+  // once the owner is up. Once the owner leaves, queries throw
+  // std::runtime_error, and a new owner only starts when the replicas of the
+  // old one are gone. A replica that dies holding the read lock stalls the
+  // owner's writes.
+  explicit Ranking(boost::interprocess::open_only_t,
+                   const std::string &path_ = "")
+      : mode(rank_mode::competition),
+        path(path_),
+        replica(true),
+        remover(false) {
+    map_backing(open_backing());
+    open_segment(true);
+    attach();
+    try {
+      auto lock = lock_shared();
+      mode = meta->mode;
+      weights = meta->weights;
+    } catch (...) {
+      detach();
+      throw;
+    }
+  }
 
-    ca_ptr = new char_allocator(segment->get_allocator<char>());
+  Ranking(const Ranking &) = delete;
+  Ranking &operator=(const Ranking &) = delete;
 
-    init_index();
+  ~Ranking() {
+    if (replica) {
+      detach();
+    } else {
+      owner->generation++;
+      owner->pid = 0;
+    }
+    delete ca_ptr;
+    managed.reset();
+    ::munmap(base, reserved ? reserved : mapped.load());
+    if (!path.empty()) ::close(fd);
+  }
+
+  bool is_persistent() const { return !path.empty(); }
+
+  bool is_replica() const { return replica; }
+
+  // Checkpoint: msyncs a file backed segment under the read lock, so the
+  // file on disk holds the state between two writes. A process that dies
+  // mid-write still leaves the mapping itself half updated; this guards
+  // against losing the page cache, not against torn writes.
+  bool flush() {
+    if (path.empty()) return true;
+    read_lock_t lock(*mtx);
+    return ::msync(base, mapped, MS_SYNC) == 0;
   }
 
-  void clear() { users->clear(); }
+  SegmentStats get_segment_stats() {
+    auto lock = lock_shared();
+    SegmentStats stats;
+    stats.size = segment->get_size();
+    stats.free = segment->get_free_memory();
+    stats.reserved = reserved;
+    stats.grows = grows;
+    // the algorithm is a private base of the segment manager, which only a
+    // C-style cast may convert to
+    stats.allocations =
+        ((const segment_t::memory_algorithm *)segment)->get_allocations();
+    return stats;
+  }
+
+  // a write to every rank, so cached pages go too
+  void clear() {
+    auto lock = lock_exclusive();
+    users->clear();
+    for (auto scores : distinct) scores->clear();
+    for (auto board : boards) board->clear();
+    stamps->version++;
+    if (!stamps->tracking) return;
+    for (auto &index : stamps->touched)
+      for (auto &bucket : index)
+        bucket.store(stamps->version, std::memory_order_release);
+  }
+
+  rank_mode get_rank_mode() const { return mode; }
 
   inline auto &get_ca() { return *ca_ptr; }
 
+  // unsynchronized: hold the lock, or use with_user from other threads
   inline auto get_user(uint32_t uid) {
     auto iter = uid_index->find(uid);
     if (iter == uid_index->end()) throw NoneOfUidException(uid);
     return iter;
   }
 
-  void put_user(User const &user) { users->insert(user); }
+  // f sees the user under the read lock, the reference must not escape
+  template <typename Func>
+  auto with_user(uint32_t uid, Func &&f) {
+    auto lock = lock_shared();
+    return f(*get_user(uid));
+  }
+
+  // Unsynchronized writes, handed out by write_batch while it holds the
+  // write lock. Misses are reported as false instead of thrown.
+  class Batch {
+   public:
+    // The user is moved into its node, a long name changes hands instead
+    // of being copied. Nothing is moved when the uid is taken.
+    bool put(User &&user) {
+      rank.reserve_free(write_bytes + user.name.size());
+      user.hybrid = rank.weights(user);
+      return rank.inserted(rank.users->insert(std::move(user)));
+    }
+
+    bool put(User const &user) { return put(User(user)); }
+
+    // Builds the user right in its node. A taken uid still costs the node
+    // and the name, the container only finds out once they are built.
+    bool emplace(uint32_t uid, const scores_t &scores,
+                 boost::string_view name) {
+      rank.reserve_free(write_bytes + name.size());
+      return rank.inserted(rank.users->emplace(uid, scores, name, rank.get_ca(),
+                                               rank.weights(scores)));
+    }
+
+    // emplace for uids in ascending order: the user goes in right before
+    // hint in the uid index, which then points past it for the next uid.
+    // The ranked indices are searched as usual.
+    bool emplace_hint(uid_index_t::iterator &hint, uint32_t uid,
+                      const scores_t &scores, boost::string_view name) {
+      rank.reserve_free(write_bytes + name.size());
+      size_t size = rank.users->size();
+      auto it = rank.uid_index->emplace_hint(hint, uid, scores, name,
+                                             rank.get_ca(),
+                                             rank.weights(scores));
+      hint = std::next(it);
+      return rank.inserted(std::make_pair(it, rank.users->size() > size));
+    }
+
+    // Writes the fields in place. The name is only reallocated when it
+    // changes, and a ranked index whose score stays keeps the node where it
+    // is: it is not recounted, and only stamped at its one position. Every
+    // board shows the whole user, so the old positions are stamped in all of
+    // them.
+    bool modify(uint32_t uid, const scores_t &scores,
+                boost::string_view name) {
+      auto iter = rank.uid_index->find(uid);
+      if (iter == rank.uid_index->end()) return false;
+      rescore(iter, scores, &name);
+      return true;
+    }
+
+    bool modify(User const &user) {
+      return modify(user.uid, user.scores, user.name.view());
+    }
+
+    // Adds the deltas to the scores, which stop at 0 and UINT32_MAX, as
+    // modify with the name left alone: only the indices of a score that
+    // changes move.
+    bool incr(uint32_t uid, const deltas_t &deltas) {
+      auto iter = rank.uid_index->find(uid);
+      if (iter == rank.uid_index->end()) return false;
+      scores_t scores;
+      for (int i = 0; i < score_field_cnt; i++)
+        scores[i] = clamp_score(iter->scores[i] + deltas[i]);
+      rescore(iter, scores, nullptr);
+      return true;
+    }
+
+    bool remove(uint32_t uid) {
+      auto iter = rank.uid_index->find(uid);
+      if (iter == rank.uid_index->end()) return false;
+      rank.stamps->version++;
+      rank.stamp(iter);
+      rank.count_scores(*iter, -1);
+      rank.forget_windows(uid);
+      rank.uid_index->erase(iter);
+      return true;
+    }
+
+   private:
+    friend class Ranking;
+    explicit Batch(Ranking &rank_) : rank(rank_) {}
+    Ranking &rank;
+
+    static uint32_t clamp_score(int64_t score) {
+      return score < 0 ? 0 : score > UINT32_MAX ? UINT32_MAX : score;
+    }
+
+    // modify of the user at iter, renamed unless name is null
+    void rescore(uid_index_t::iterator iter, const scores_t &scores,
+                 const boost::string_view *name) {
+      uint32_t uid = iter->uid;
+      uint64_t hybrid = rank.weights(scores);
+      uint32_t before = iter->score<tag_activity>();
+      // the scores only, an empty name stays inline
+      User updated(uid, scores, {}, rank.get_ca(), hybrid);
+      unsigned moved = moved_indices(*iter, updated);
+      bool renamed = name && !(iter->name == *name);
+      if (!moved && !renamed) return;
+
+      rank.reserve_free(write_bytes + (renamed ? name->size() : 0));
+      rank.stamps->version++;
+      rank.stamp(iter);
+      rank.count_scores(*iter, -1, moved);
+      rank.uid_index->modify(iter, [&](User &user) {
+        user.scores = scores;
+        user.hybrid = hybrid;
+        if (renamed) user.name.assign(*name, rank.get_ca());
+      });
+      rank.count_scores(*iter, 1, moved);
+      rank.gain(uid, before, updated.score<tag_activity>());
+      rank.stamp(iter, moved);
+    }
+  };
+
+  // one lock round trip for any number of writes
+  template <typename Func>
+  void write_batch(Func &&f) {
+    auto lock = lock_exclusive();
+    Batch batch(*this);
+    f(batch);
+  }
+
+  // Unsynchronized reads, handed out by read_batch while it holds the read
+  // lock, so several queries see the same state.
+  class View {
+   public:
+    // writes seen so far, counted with tracking on or off; only the stamps
+    // wait for track_writes()
+    uint64_t version() const { return rank.stamps->version; }
+
+    // Streams positions [offset, offset + count) of the Tag index to
+    // f(rank, user), starting from a single nth() descent, and those of a
+    // window board to f(rank, user, score). rank is the one get_rank gives:
+    // the first user's is looked up, the rest follow from it, the same while
+    // the score is. Returns how many users were visited.
+    template <typename Tag, typename Func>
+    uint32_t range(uint32_t offset, uint32_t count, Func &&f) const {
+      return range_on(Tag(), offset, count, f);
+    }
+
+   private:
+    template <typename Tag, typename Func>
+    uint32_t range_on(Tag, uint32_t offset, uint32_t count, Func &f) const {
+      auto &index = boost::get<Tag>(*rank.users);
+      uint32_t visited = 0, r = 0;
+      typename rank_index_traits<Tag>::score_t last{};
+      for (auto it = index.nth(offset); visited < count && it != index.end();
+           ++it, ++visited) {
+        auto score = rank_index_traits<Tag>::score(*it);
+        if (!visited)
+          r = rank.rank_of<Tag>(it);
+        else if (rank.mode == rank_mode::ordinal || score != last)
+          r = rank.mode == rank_mode::dense ? r + 1 : offset + visited;
+        last = score;
+        f(r, *it);
+      }
+      return visited;
+    }
+
+    // the board's stale entries end the window
+    template <int Ago, typename Func>
+    uint32_t range_on(tag_window<Ago>, uint32_t offset, uint32_t count,
+                      Func &f) const {
+      uint32_t w;
+      if (!rank.window_of(Ago, w)) return 0;
+      auto &index = boost::get<tag_activity>(*rank.boards[w % 2]);
+      uint32_t visited = 0, r = 0;
+      for (auto it = index.nth(offset);
+           visited < count && it != index.end() && it->window == w;
+           ++it, ++visited) {
+        // competition ranks
+        if (!visited)
+          r = index.lower_bound_rank(boost::make_tuple(w, it->score));
+        else if (it->score != std::prev(it)->score)
+          r = offset + visited;
+        f(r, *rank.uid_index->find(it->uid), it->score);
+      }
+      return visited;
+    }
+
+    friend class Ranking;
+    explicit View(Ranking &rank_) : rank(rank_) {}
+    Ranking &rank;
+  };
+
+  template <typename Func>
+  auto read_batch(Func &&f) {
+    auto lock = lock_shared();
+    View view(*this);
+    return f(view);
+  }
+
+  // start scoring activity in windows, from the current one on
+  void track_windows() {
+    auto lock = lock_exclusive();
+    windows->tracking = true;
+  }
+
+  // Makes window the current one, unless it is not ahead of it. The window
+  // before it becomes the last one, an empty one when window skips some.
+  void start_window(uint32_t window) {
+    auto lock = lock_exclusive();
+    if (window > windows->current) windows->current = window;
+  }
+
+  uint32_t current_window() {
+    auto lock = lock_shared();
+    return windows->current;
+  }
+
+  // start stamping writes, see last_write_above
+  void track_writes() {
+    write_lock_t lock(*mtx);
+    stamps->tracking = true;
+  }
+
+  // whether writes are stamped, by this process or the owner of a replica
+  bool tracks_writes() const { return stamps->tracking.load(); }
+
+  // Version of the latest write that may have moved any of the top `end`
+  // entries of the Tag index. Lock-free; rounds up to a power-of-two bucket,
+  // so it can report writes a little below end as well.
+  template <typename Tag>
+  uint64_t last_write_above(uint32_t end) const {
+    auto &touched = stamps->touched[rank_index_id<Tag>()];
+    uint64_t last = 0;
+    for (int b = 0, top = end ? rank_bucket(end - 1) : -1; b <= top; b++)
+      last = std::max(last, touched[b].load(std::memory_order_acquire));
+    return last;
+  }
+
+  void put_user(User const &user) {
+    auto lock = lock_exclusive();
+    Batch(*this).put(user);
+  }
+
+  void put_user(User &&user) {
+    auto lock = lock_exclusive();
+    Batch(*this).put(std::move(user));
+  }
+
+  void emplace_user(uint32_t uid, const scores_t &scores,
+                    boost::string_view name) {
+    auto lock = lock_exclusive();
+    Batch(*this).emplace(uid, scores, name);
+  }
+
+  // Puts users sorted by uid, anything with a uid, scores and a name view,
+  // bulk_block of them per write lock so queries get in between.
+  // The uid index takes them with a hint. A uid already taken, or repeated,
+  // keeps the user it has. Returns how many were put.
+  template <typename Iter>
+  uint64_t bulk_put(Iter first, Iter last) {
+    uint64_t put = 0;
+    while (first != last) {
+      Iter block_end = last - first > bulk_block ? first + bulk_block : last;
+      write_batch([&](Batch &batch) {
+        auto hint = uid_index->lower_bound(first->uid);
+        for (; first != block_end; ++first)
+          put += batch.emplace_hint(hint, first->uid, first->scores,
+                                    first->name);
+      });
+    }
+    return put;
+  }
 
   void modify_user(User const &user) {
-    auto iter = get_user(user.uid);
-    uid_index->modify(iter, [&user](User &user_) { user_ = user; });
+    auto lock = lock_exclusive();
+    if (!Batch(*this).modify(user)) throw NoneOfUidException(user.uid);
+  }
+
+  void modify_user(uint32_t uid, const scores_t &scores,
+                   boost::string_view name) {
+    auto lock = lock_exclusive();
+    if (!Batch(*this).modify(uid, scores, name)) throw NoneOfUidException(uid);
+  }
+
+  void incr_user(uint32_t uid, const deltas_t &deltas) {
+    auto lock = lock_exclusive();
+    if (!Batch(*this).incr(uid, deltas)) throw NoneOfUidException(uid);
   }
 
   void remove_user(uint32_t uid) {
-    auto iter = get_user(uid);
-    uid_index->erase(iter);
+    auto lock = lock_exclusive();
+    if (!Batch(*this).remove(uid)) throw NoneOfUidException(uid);
+  }
+
+  uint32_t get_size() {
+    auto lock = lock_shared();
+    return users->size();
   }
 
-  uint32_t get_size() { return users->size(); }
+  // Ranks of every user of batch on the indices in the indices bitmask,
+  // under one read lock. The uids are looked up in uid order, so neighbours
+  // share the upper levels of the uid index; batches of more than
+  // ranks_per_thread users are split over up to threads threads.
+  void get_ranks(std::vector<UserRanks> &batch, unsigned indices,
+                 unsigned threads = 1) {
+    std::vector<UserRanks *> order(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) order[i] = &batch[i];
+    std::sort(order.begin(), order.end(),
+              [](const UserRanks *a, const UserRanks *b) {
+                return a->uid < b->uid;
+              });
+    auto lookup = [this, &order, indices](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) fill_ranks(*order[i], indices);
+    };
 
+    threads = std::max<size_t>(
+        1, std::min<size_t>(threads, order.size() / ranks_per_thread));
+    auto lock = lock_shared();
+    if (threads == 1) return lookup(0, order.size());
+    // the workers share this thread's read lock
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++)
+      workers.emplace_back(lookup, order.size() * i / threads,
+                           order.size() * (i + 1) / threads);
+    for (auto &t : workers) t.join();
+  }
+
+  // see View::range
+  template <typename Tag, typename Func>
+  uint32_t range(uint32_t offset, uint32_t count, Func &&f) {
+    auto lock = lock_shared();
+    return View(*this).range<Tag>(offset, count, f);
+  }
+
+  // rank of uid on the Tag index under the configured rank_mode
+  template <typename Tag>
+  uint32_t get_rank(uint32_t uid) {
+    auto lock = lock_shared();
+    return rank_on(Tag(), get_user(uid));
+  }
+
+  // the indices that came before get_rank<Tag>
   uint32_t get_exp_pers_rank(uint32_t uid) {
-    return exp_pers_index->find_rank(get_user(uid)->exp_pers);
+    return get_rank<tag_exp_pers>(uid);
   }
 
   uint32_t get_activity_rank(uint32_t uid) {
-    return activity_index->find_rank(get_user(uid)->activity);
+    return get_rank<tag_activity>(uid);
   }
 
-  uint32_t get_hybrid_rank(u_int32_t uid) {
-    return hybrid_index->find_rank(get_user(uid)->by_hybrid());
+  uint32_t get_hybrid_rank(u_int32_t uid) { return get_rank<tag_hybrid>(uid); }
+
+  // ranks of uid on every ranked index from one uid lookup
+  UserRanks all_ranks(uint32_t uid) {
+    UserRanks r{uid, false, {}};
+    auto lock = lock_shared();
+    fill_ranks(r, all_rank_indices);
+    if (!r.found) throw NoneOfUidException(uid);
+    return r;
   }
 };
 
@@ -0,0 +1,132 @@
+#ifndef _ROUTER_HPP_
+#define _ROUTER_HPP_
+
+#include <stdint.h>
+
+#include <boost/utility/string_view.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Route table compiled once from rc_t keys into a byte trie.
+//
+// A key is a static prefix, optionally followed by one placeholder that has to
+// run to the end of the path:
+//   "/put"              the path must be exactly the prefix
+//   "/info?uid={uint}"  prefix, then a decimal number that fits in uint32_t
+//   "*"                 prefix, then anything (catch-all)
+//
+// When several routes match, the longest prefix wins and, at equal prefix,
+// exact beats {uint} beats *. A route whose method map has no entry for the
+// request method is skipped, the same way the regex table fell through.
+template <typename Methods>
+class Router {
+ public:
+  typedef typename Methods::mapped_type handler_t;
+
+  struct Match {
+    handler_t* handler = nullptr;
+    uint32_t param = 0;
+  };
+
+  Router() : nodes(1) {}
+
+  // the table must outlive the router: handlers are referenced, not copied
+  template <typename Table>
+  void compile(Table& table) {
+    for (auto& route : table) add(route.first, route.second);
+  }
+
+  Match match(boost::string_view path, boost::string_view method) const {
+    Match m;
+    match(0, path.data(), path.data() + path.size(), method, m);
+    return m;
+  }
+
+ private:
+  struct Node {
+    std::vector<std::pair<char, uint32_t>> next;
+    Methods* exact = nullptr;
+    Methods* uint_tail = nullptr;
+    Methods* any_tail = nullptr;
+  };
+
+  std::vector<Node> nodes;
+
+  void add(const std::string& key, Methods& methods) {
+    static const std::string uint_placeholder = "{uint}";
+    std::string prefix = key;
+    Methods* Node::*slot = &Node::exact;
+
+    if (prefix.size() >= uint_placeholder.size() &&
+        !prefix.compare(prefix.size() - uint_placeholder.size(),
+                        std::string::npos, uint_placeholder)) {
+      prefix.resize(prefix.size() - uint_placeholder.size());
+      slot = &Node::uint_tail;
+    } else if (!prefix.empty() && prefix.back() == '*') {
+      prefix.pop_back();
+      slot = &Node::any_tail;
+    }
+
+    uint32_t n = 0;
+    for (char ch : prefix) {
+      uint32_t next = child(n, ch);
+      if (!next) {
+        next = nodes.size();
+        nodes[n].next.emplace_back(ch, next);
+        nodes.emplace_back();
+      }
+      n = next;
+    }
+    nodes[n].*slot = &methods;
+  }
+
+  // node 0 is the root, so it doubles as "no edge"
+  uint32_t child(uint32_t n, char ch) const {
+    for (auto& edge : nodes[n].next)
+      if (edge.first == ch) return edge.second;
+    return 0;
+  }
+
+  static bool parse_uint(const char* p, const char* end, uint32_t& value) {
+    if (p == end) return false;
+    uint64_t v = 0;
+    for (; p != end; p++) {
+      if (*p < '0' || *p > '9') return false;
+      v = v * 10 + (*p - '0');
+      if (v > UINT32_MAX) return false;
+    }
+    value = static_cast<uint32_t>(v);
+    return true;
+  }
+
+  // a route has one or two methods, a scan beats hashing the method name
+  static bool accept(Methods* methods, boost::string_view method, Match& m) {
+    if (!methods) return false;
+    for (auto& it : *methods) {
+      if (method == it.first) {
+        m.handler = &it.second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // depth is bounded by the longest route key, not by the request path
+  bool match(uint32_t n, const char* p, const char* end,
+             boost::string_view method, Match& m) const {
+    const Node& node = nodes[n];
+    if (p != end) {
+      uint32_t next = child(n, *p);
+      if (next && match(next, p + 1, end, method, m)) return true;
+    } else if (accept(node.exact, method, m)) {
+      return true;
+    }
+    if (node.uint_tail && parse_uint(p, end, m.param) &&
+        accept(node.uint_tail, method, m))
+      return true;
+    return accept(node.any_tail, method, m);
+  }
+};
+
+#endif  // !_ROUTER_HPP_
@@ -0,0 +1,94 @@
+#ifndef _SCHEMA_HPP_
+#define _SCHEMA_HPP_
+
+#include <stdint.h>
+
+#include <array>
+#include <boost/utility/string_view.hpp>
+#include <initializer_list>
+
+// A list of ranked index tags. for_each calls f(tag) for every one in
+// order, unrolled at compile time.
+template <typename... Tags>
+struct rank_index_list {
+  static constexpr int size = sizeof...(Tags);
+
+  template <typename... More>
+  using append = rank_index_list<Tags..., More...>;
+
+  template <typename Func>
+  static void for_each(Func &&f) {
+    (void)std::initializer_list<int>{(f(Tags()), 0)...};
+  }
+};
+
+// Position of Tag in a rank_index_list: its dense id for per-index runtime
+// state, and its index in the container.
+template <typename Tag, typename List>
+struct rank_index_pos;
+template <typename Tag, typename... Rest>
+struct rank_index_pos<Tag, rank_index_list<Tag, Rest...>> {
+  static constexpr int value = 0;
+};
+template <typename Tag, typename First, typename... Rest>
+struct rank_index_pos<Tag, rank_index_list<First, Rest...>> {
+  static constexpr int value =
+      1 + rank_index_pos<Tag, rank_index_list<Rest...>>::value;
+};
+
+struct tag_exp_pers {};
+struct tag_activity {};
+
+// Per stored score: the name it goes by in /put bodies, /incr, queries and
+// routes, and the label of its single-rank answer.
+template <typename Tag>
+struct score_field_traits;
+template <>
+struct score_field_traits<tag_exp_pers> {
+  static constexpr const char *name() { return "exp_pers"; }
+  static constexpr const char *label() { return "Exp_Pers"; }
+};
+template <>
+struct score_field_traits<tag_activity> {
+  static constexpr const char *name() { return "activity"; }
+  static constexpr const char *label() { return "activity"; }
+};
+
+// The scores a user stores, the one place that lists them. Each is a
+// uint32_t and a ranked index of its own. Generated from here: the scores
+// of User and UserFields, the /put keys, the hybrid weights, the puts,
+// modifies and incrs of Ranking and BatchWriter, the /incr fields and the
+// binary bulk record. A new score is a tag, its score_field_traits and its
+// entry here. It changes the node layout, so a data file written before
+// does not open.
+typedef rank_index_list<tag_exp_pers, tag_activity> score_fields;
+constexpr int score_field_cnt = score_fields::size;
+
+// a value per stored score, in score_fields order
+typedef std::array<uint32_t, score_field_cnt> scores_t;
+typedef std::array<int64_t, score_field_cnt> deltas_t;
+
+template <typename Tag>
+constexpr int score_field_id() {
+  return rank_index_pos<Tag, score_fields>::value;
+}
+
+// id of the stored score called name, -1 for none
+inline int score_field_of(boost::string_view name) {
+  int field = -1, id = 0;
+  score_fields::for_each([&](auto tag) {
+    if (name == score_field_traits<decltype(tag)>::name()) field = id;
+    id++;
+  });
+  return field;
+}
+
+// delta on the Tag score alone
+template <typename Tag>
+deltas_t delta_of(int64_t delta) {
+  deltas_t deltas{};
+  deltas[score_field_id<Tag>()] = delta;
+  return deltas;
+}
+
+#endif  // !_SCHEMA_HPP_
@@ -3,27 +3,29 @@
 
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
+#include <pthread.h>
+#include <sched.h>
+
 #include <boost/asio.hpp>
 #include <boost/asio/signal_set.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
+#include <boost/bind.hpp>
+#include <array>
 #include <cassert>
+#include <cstdio>
 #include <iostream>
-#include <list>
-#include <regex>
-#include <sstream>
 #include <unordered_map>
 #include <vector>
 
+#include "batch_writer.hpp"
+#include "bulk_loader.hpp"
 #include "exception.hpp"
+#include "http_parser.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "page_cache.hpp"
 #include "ranking.hpp"
-
-struct Request {
-  std::string method, path, http_version;
-  std::string content;
-  std::unordered_map<std::string, std::string> header;
-  std::smatch path_match;
-};
+#include "router.hpp"
+#include "user_parser.hpp"
 
 // path --- method --- function
 typedef std::map<std::string,
@@ -31,27 +33,84 @@ typedef std::map<std::string,
                      std::string, std::function<void(std::ostream&, Request&)>>>
     rc_t;
 
+// How the service threads share connections:
+//   shared    all threads run one io_service and take turns on its reactor,
+//             a connection's handlers run on whichever thread is free
+//   per_core  every thread runs an io_service of its own, with its own
+//             SO_REUSEPORT acceptor on the port, pinned to a core; the kernel
+//             spreads new connections over the acceptors and a connection
+//             stays on the thread that accepted it
+// Either way no handler blocks its thread: writes are deferred to the batch
+// writer and answered from its callback.
+enum class threading { shared, per_core };
+
 class Server {
  private:
-  boost::asio::io_service io_service;
+  // An io_service with an acceptor of its own on the port.
+  struct Loop {
+    boost::asio::io_service io;
+    boost::asio::io_service::work work;
+    boost::asio::ip::tcp::acceptor acceptor;
+
+    Loop(const boost::asio::ip::tcp::endpoint& endpoint, int concurrency_hint,
+         bool reuse_port)
+        : io(concurrency_hint), work(io), acceptor(io) {
+      typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+                                                          SO_REUSEPORT>
+          reuse_port_t;
+      acceptor.open(endpoint.protocol());
+      acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+      if (reuse_port) acceptor.set_option(reuse_port_t(true));
+      acceptor.bind(endpoint);
+      acceptor.listen();
+    }
+  };
+
   boost::asio::ip::tcp::endpoint endpoint;
-  boost::asio::ip::tcp::acceptor acceptor;
+  const threading model;
+  // before the loops: the sessions their io_services destroy count
+  // themselves out of it
+  Metrics metrics;
+  // one for shared, one per service thread for per_core; the first one also
+  // runs the signal handler and the checkpoints
+  std::vector<std::unique_ptr<Loop>> loops;
   boost::asio::signal_set signals;
-  boost::asio::io_service::work work;
   rc_t rc;
   rc_t exception_rc;
-  std::vector<rc_t::iterator> rc_vec;
-  std::list<std::string> json_fields;
+  Router<rc_t::mapped_type> router;
+  // route numbers for metrics, by handler
+  std::unordered_map<const Router<rc_t::mapped_type>::handler_t*, uint32_t>
+      route_of;
   uint32_t service_cnt;
   std::vector<std::thread> threads;
   const std::thread::id main_thread_id;
-
-  Ranking rank;
+  static constexpr size_t read_chunk = 4096;
+  // a connection is closed when a request takes longer to arrive
+  const boost::posix_time::seconds idle_timeout{60};
+  static constexpr uint32_t default_top_count = 10;
+  static constexpr uint32_t max_top_count = 1000;
+  static constexpr size_t max_ranks_batch = 1 << 16;
+  // file backed rankings are msynced this often and on shutdown
+  const boost::posix_time::seconds checkpoint_interval{30};
+  boost::asio::deadline_timer checkpoint_timer;
+  // activity windows of window_period seconds, none when 0, each starting
+  // window_offset seconds into a period counted from the Unix epoch
+  uint32_t window_period = 0, window_offset = 0;
+  boost::asio::deadline_timer window_timer;
+  Logger logger;
+
+  std::unique_ptr<Ranking> rank_ptr;
+  Ranking& rank;
+  BatchWriter writer;
+  PageCache page_cache;
 
   void handler(const boost::system::error_code& error, int signal_number) {
+    // unwinds through start() so the leaderboard is left, which its
+    // replicas see
     if (!error) {
-      std::cout << "Bye!" << std::endl;
-      exit(1);
+      rank.flush();
+      logger.flush();
+      stop();
     }
   }
 
@@ -60,260 +119,598 @@ class Server {
     signals.async_wait(boost::bind(&Server::handler, this, _1, _2));
   }
 
-  void config_json() {
-    const char* cstrs[] = {"uid", "name", "exp_pers", "activity"};
-    json_fields.assign(cstrs, std::end(cstrs));
+  void config_checkpoint() {
+    if (!rank.is_persistent()) return;
+    checkpoint_timer.expires_from_now(checkpoint_interval);
+    checkpoint_timer.async_wait([this](const boost::system::error_code& ec) {
+      if (ec) return;
+      if (!rank.flush()) logger.line(log_level::error) << "checkpoint failed";
+      config_checkpoint();
+    });
   }
 
-  void write_response(std::ostream& response,
-                      std::stringstream& content_stream) {
-    content_stream.seekp(0, std::ios::end);
-    response << "HTTP/1.1 200 OK\r\n"
-             // length
-             << "Content-Length: " << content_stream.tellp()
-             << "\r\n"
-             // cors
-             << "Access-Control-Allow-Origin: *\r\n"
-             << "Access-Control-Allow-Methods: POST, GET, OPTIONS\r\n"
-             << "Access-Control-Allow-Credentials: true\r\n"
-             << "Access-Control-Allow-Headers: *\r\n"
-             // end headers
-             << "\r\n"
-             // content
-             << content_stream.rdbuf();
+  // starts the window the clock is in, and the next one when it is due
+  void config_windows() {
+    if (!window_period || rank.is_replica()) return;
+    rank.track_windows();
+    uint64_t now = time(nullptr) - window_offset;
+    rank.start_window(now / window_period);
+    window_timer.expires_from_now(
+        boost::posix_time::seconds(window_period - now % window_period));
+    window_timer.async_wait([this](const boost::system::error_code& ec) {
+      if (!ec) config_windows();
+    });
+  }
+
+  // Ends the head of every response, after the status line and length.
+  static boost::asio::const_buffer common_headers() {
+    static const char block[] =
+        // cors
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Methods: POST, GET, OPTIONS\r\n"
+        "Access-Control-Allow-Credentials: true\r\n"
+        "Access-Control-Allow-Headers: *\r\n"
+        // end headers
+        "\r\n";
+    return boost::asio::buffer(block, sizeof(block) - 1);
+  }
+
+  // Defers request and answers it with what answer(response, ok) writes
+  // once the writer is done, or with "Write Failed" when the write threw.
+  template <typename Answer>
+  BatchWriter::callback_t reply_write(Request& request, Answer answer) {
+    auto reply = request.defer();
+    return [this, reply, answer](bool ok, std::exception_ptr error) {
+      if (error) {
+        try {
+          std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+          logger.line(log_level::error) << "write failed: " << e.what();
+        } catch (...) {
+          logger.line(log_level::error) << "write failed";
+        }
+        return reply([](std::ostream& response) {
+          response << "Write Failed";
+        });
+      }
+      reply([answer, ok](std::ostream& response) { answer(response, ok); });
+    };
   }
 
   void config_rc() {
     // rc
     // get info by uid
-    rc["(/info\\\?uid=)(\\d+)$"]["GET"] = [this](std::ostream& response,
-                                                 Request& request) {
-      std::stringstream content_stream;
-
+    rc["/info?uid={uint}"]["GET"] = [this](std::ostream& response,
+                                          Request& request) {
       try {
-        uint32_t uid = std::stoul(request.path_match[2], 0, 10);
-        auto iter = rank.get_user(uid);
-        content_stream << (*iter);
+        uint32_t uid = request.path_param;
+        rank.with_user(uid, [&](const User& user) { response << user; });
       } catch (const NoneOfUidException& e) {
-        content_stream << "User " << e.what() << " doesn't exist.";
+        response << "User " << e.what() << " doesn't exist.";
       }
-      // will not caused by stoul bacause of regex match
-      // catch (std::invalid_argument& e) {
-      //   content_stream << "Bad Param";
-      // }
-
-      write_response(response, content_stream);
+      // uid is range-checked by the router, anything else falls to Bad GET
     };
 
     // put user
-    rc["/put$"]["POST"] = [this](std::ostream& response, Request& request) {
-      std::stringstream post_stream, content_stream;
-      post_stream << request.content;
-      boost::property_tree::ptree pt;
-
-      try {
-        boost::property_tree::read_json(post_stream, pt);
-        auto iter = pt.begin();
-
-        // parse
-        for (auto field : json_fields)
-          if (((iter++)->first).compare(field))
-            throw IncorrectHttpRequestException(field);
-
-        User user(rank.get_ca());
-        user.assign(pt.begin(), rank.get_ca());
-        rank.put_user(user);
-        std::cout << user;
-        content_stream << "Put Successfully";
-      } catch (const IncorrectHttpRequestException& e) {
-        std::cout << "HttpRequest Incorrect: " << e.what() << std::endl;
-        content_stream << "Bad Put";
-      } catch (boost::property_tree::ptree_error& e) {
-        std::cout << e.what() << std::endl;
-        content_stream << "Bad Param";
+    rc["/put"]["POST"] = [this](std::ostream& response, Request& request) {
+      // the name may be decoded into the parser, which is kept per thread
+      thread_local UserParser parser;
+      UserFields fields;
+
+      switch (parser.parse(request.content, fields)) {
+        case UserParser::Status::ok: {
+          {
+            auto line = logger.line(log_level::info);
+            line << "User: " << fields.uid << "\tname: " << fields.name;
+            score_fields::for_each([&](auto tag) {
+              line << "\t" << score_field_traits<decltype(tag)>::name()
+                   << ": " << fields.scores[score_field_id<decltype(tag)>()];
+            });
+          }
+          User user(fields.uid, fields.scores, fields.name, rank.get_ca());
+          // answered once the writer has applied it
+          auto answer = [](std::ostream& response, bool) {
+            response << "Put Successfully";
+          };
+          writer.put(std::move(user), reply_write(request, answer));
+          break;
+        }
+        case UserParser::Status::bad_field:
+          logger.line(log_level::warn)
+              << "HttpRequest Incorrect: " << request.content;
+          response << "Bad Put";
+          break;
+        case UserParser::Status::bad_json:
+          logger.line(log_level::warn) << "Bad JSON: " << request.content;
+          response << "Bad Param";
+          break;
       }
-
-      write_response(response, content_stream);
     };
 
-    // remove user
-    rc["(/remove\\\?uid=)(\\d+)$"]["GET"] = [this](std::ostream& response,
-                                                   Request& request) {
-      std::stringstream content_stream;
+    // put many users, NDJSON or binary records, see bulk_loader.hpp
+    rc["/bulk_put"]["POST"] = [this](std::ostream& response,
+                                     Request& request) {
+      auto records = std::make_shared<BulkRecords>();
+      uint64_t bad_at;
 
-      try {
-        uint32_t uid = std::stoul(request.path_match[2], 0, 10);
-        rank.remove_user(uid);
-        content_stream << "Remove Successfully";
-      } catch (const NoneOfUidException& e) {
-        content_stream << "User " << e.what() << " doesn't exist.";
+      if (!parse_bulk(request.content, *records, bad_at,
+                      std::thread::hardware_concurrency())) {
+        response << "Bad Bulk Put at " << bad_at;
+        return;
       }
-
-      write_response(response, content_stream);
+      // put by the writer, between its batches
+      auto put = std::make_shared<uint64_t>(0);
+      auto job = [this, records, put]() {
+        *put = rank.bulk_put(records->users.begin(), records->users.end());
+        return true;
+      };
+      auto answer = [records, put](std::ostream& response, bool) {
+        response << "Put " << *put << " of " << records->users.size();
+      };
+      writer.call(job, reply_write(request, answer));
     };
 
-    // get exp_pers rank
-    rc["(/get_exp_pers\\\?uid=)(\\d+)$"]["GET"] = [this](std::ostream& response,
-                                                         Request& request) {
-      std::stringstream content_stream;
-
-      try {
-        uint32_t uid = std::stoul(request.path_match[2], 0, 10);
-        content_stream << "Exp_Pers Rank: " << rank.get_exp_pers_rank(uid);
-      } catch (const NoneOfUidException& e) {
-        content_stream << "User " << e.what() << " doesn't exist.";
+    // add delta to a score of a user: /incr?uid=1&field=exp_pers&delta=-50,
+    // field one of score_fields
+    auto incr = [this](std::ostream& response, Request& request) {
+      boost::string_view param;
+      uint32_t uid;
+      int field;
+      deltas_t deltas{};
+      if (!find_query_param(request.path, "uid", param) ||
+          !parse_uint(param, uid) ||
+          !find_query_param(request.path, "field", param) ||
+          (field = score_field_of(param)) < 0 ||
+          !find_query_param(request.path, "delta", param) ||
+          !parse_int(param, deltas[field])) {
+        response << "Bad Param";
+        return;
       }
+      auto answer = [uid](std::ostream& response, bool ok) {
+        if (ok)
+          response << "Incr Successfully";
+        else
+          response << "User " << uid << " doesn't exist.";
+      };
+      writer.incr(uid, deltas, reply_write(request, answer));
+    };
+    rc["/incr?*"]["GET"] = incr;
+    rc["/incr?*"]["POST"] = incr;
 
-      write_response(response, content_stream);
+    // remove user
+    rc["/remove?uid={uint}"]["GET"] = [this](std::ostream& response,
+                                            Request& request) {
+      uint32_t uid = request.path_param;
+      auto answer = [uid](std::ostream& response, bool ok) {
+        if (ok)
+          response << "Remove Successfully";
+        else
+          response << "User " << uid << " doesn't exist.";
+      };
+      writer.remove(uid, reply_write(request, answer));
     };
 
-    // get activity rank
-    rc["(/get_activity\\\?uid=)(\\d+)$"]["GET"] = [this](std::ostream& response,
-                                                         Request& request) {
-      std::stringstream content_stream;
+    // get the rank on each ranked index, /get_exp_pers?uid= and so on
+    rank_indices::for_each([this](auto tag) {
+      typedef decltype(tag) tag_t;
+      std::string path = std::string("/get_") +
+                         rank_index_traits<tag_t>::name() + "?uid={uint}";
+      rc[path]["GET"] = [this](std::ostream& response, Request& request) {
+        try {
+          uint32_t uid = request.path_param;
+          response << rank_index_traits<tag_t>::label()
+                   << " Rank: " << rank.get_rank<tag_t>(uid);
+        } catch (const NoneOfUidException& e) {
+          response << "User " << e.what() << " doesn't exist.";
+        }
+      };
+    });
+
+    // activity ranks in the current and the last window, see set_windows
+    auto window_rank = [this](auto tag, const char* label) {
+      return [this, label](std::ostream& response, Request& request) {
+        try {
+          uint32_t uid = request.path_param;
+          response << label << " Rank: "
+                   << rank.get_rank<decltype(tag)>(uid);
+        } catch (const NoneOfUidException& e) {
+          response << "User " << e.what() << " doesn't exist.";
+        }
+      };
+    };
+    rc["/get_window?uid={uint}"]["GET"] =
+        window_rank(tag_this_window(), "Window");
+    rc["/get_last_window?uid={uint}"]["GET"] =
+        window_rank(tag_last_window(), "Last Window");
+
+    // get ranks [offset, offset + count) of an index, or of index=window and
+    // last_window
+    rc["/top?*"]["GET"] = [this](std::ostream& response, Request& request) {
+      boost::string_view index, param;
+      uint32_t offset = 0, count = default_top_count;
+
+      bool ok = find_query_param(request.path, "index", index);
+      if (find_query_param(request.path, "offset", param))
+        ok = ok && parse_uint(param, offset);
+      if (find_query_param(request.path, "count", param))
+        ok = ok && parse_uint(param, count) && count <= max_top_count;
+
+      // hot pages go out as shared pre-rendered bodies
+      auto serve = [&](auto tag) {
+        typedef decltype(tag) tag_t;
+        auto render = [&](Ranking::View& view, std::ostream& out) {
+          view.range<tag_t>(offset, count, [&](uint32_t r, const User& user) {
+            out << "Rank: " << r << "\t" << user;
+          });
+        };
+        request.shared_response =
+            page_cache.get<tag_t>(offset, count, render);
+        if (!request.shared_response)
+          rank.read_batch([&](Ranking::View& view) { render(view, response); });
+      };
+
+      // window boards change on every gain, so they skip the page cache
+      auto serve_window = [&](auto tag) {
+        rank.read_batch([&](Ranking::View& view) {
+          view.range<decltype(tag)>(
+              offset, count,
+              [&](uint32_t r, const User& user, uint32_t score) {
+                response << "Rank: " << r << "\tWindow: " << score << "\t"
+                         << user;
+              });
+        });
+      };
+
+      if (!ok)
+        response << "Bad Param";
+      else if (index == "window")
+        serve_window(tag_this_window());
+      else if (index == "last_window")
+        serve_window(tag_last_window());
+      else if (!with_rank_index(index, serve))
+        response << "Bad Param";
+    };
 
-      try {
-        uint32_t uid = std::stoul(request.path_match[2], 0, 10);
-        content_stream << "activity Rank: " << rank.get_activity_rank(uid);
-      } catch (const NoneOfUidException& e) {
-        content_stream << "User " << e.what() << " doesn't exist.";
+    // ranks of many users at once: uids=1,2,3 in the query, or for POST in
+    // the body, on the indices in index=exp_pers,activity (all by default)
+    auto ranks = [this](std::ostream& response, Request& request) {
+      // kept per thread so a batch allocates once it has seen its largest
+      thread_local std::vector<UserRanks> batch;
+      batch.clear();
+      boost::string_view uids = request.content, index;
+      unsigned indices = all_rank_indices;
+
+      bool ok = request.method == "POST" ||
+                find_query_param(request.path, "uids", uids);
+      ok = ok && for_each_token(uids, [&](boost::string_view token) {
+             uint32_t uid;
+             if (!parse_uint(token, uid) || batch.size() == max_ranks_batch)
+               return false;
+             batch.push_back(UserRanks{uid, false, {}});
+             return true;
+           });
+      if (ok && find_query_param(request.path, "index", index)) {
+        indices = 0;
+        ok = for_each_token(index, [&](boost::string_view name) {
+          return with_rank_index(name, [&](auto tag) {
+            indices |= rank_index_bit<decltype(tag)>();
+          });
+        });
+      }
+      if (!ok || !indices) {
+        response << "Bad Param";
+        return;
       }
 
-      write_response(response, content_stream);
+      rank.get_ranks(batch, indices, std::thread::hardware_concurrency());
+      for (auto& user : batch) {
+        response << "User: " << user.uid;
+        if (!user.found) {
+          response << " doesn't exist.\n";
+          continue;
+        }
+        rank_indices::for_each([&](auto tag) {
+          typedef decltype(tag) tag_t;
+          if (indices & rank_index_bit<tag_t>())
+            response << "\t" << rank_index_traits<tag_t>::name() << ": "
+                     << user.ranks[rank_index_id<tag_t>()];
+        });
+        response << "\n";
+      }
+    };
+    rc["/ranks?*"]["GET"] = ranks;
+    rc["/ranks?*"]["POST"] = ranks;
+    rc["/ranks"]["POST"] = ranks;
+
+    // latencies by route and the state of the server, for Prometheus
+    rc["/metrics"]["GET"] = [this](std::ostream& response, Request& request) {
+      SegmentStats stats = rank.get_segment_stats();
+      metrics.write_prometheus(response);
+      response << "# TYPE webserver_users gauge\n"
+               << "webserver_users " << rank.get_size() << "\n"
+               << "# TYPE webserver_segment_bytes gauge\n"
+               << "webserver_segment_bytes " << stats.size << "\n"
+               << "# TYPE webserver_segment_free_bytes gauge\n"
+               << "webserver_segment_free_bytes " << stats.free << "\n"
+               << "# TYPE webserver_connections gauge\n"
+               << "webserver_connections " << metrics.connections.load()
+               << "\n"
+               << "# TYPE webserver_requests_in_flight gauge\n"
+               << "webserver_requests_in_flight " << metrics.in_flight.load()
+               << "\n"
+               << "# TYPE webserver_write_queue_depth gauge\n"
+               << "webserver_write_queue_depth " << writer.depth() << "\n";
     };
 
     // exception_rc
     // get
-    exception_rc["(.*)"]["GET"] = [this](std::ostream& response,
-                                         Request& request) {
-      std::stringstream content_stream;
-
-      content_stream << "<h1>Bad GET</h1>";
-
-      write_response(response, content_stream);
+    exception_rc["*"]["GET"] = [this](std::ostream& response,
+                                    Request& request) {
+      response << "<h1>Bad GET</h1>";
     };
 
     // options
-    exception_rc["(.*)"]["OPTIONS"] = [this](std::ostream& response,
-                                             Request& request) {
-      std::stringstream content_stream;
-
-      content_stream << "<h1>OPTIONS</h1>";
-
-      write_response(response, content_stream);
+    exception_rc["*"]["OPTIONS"] = [this](std::ostream& response,
+                                        Request& request) {
+      response << "<h1>OPTIONS</h1>";
     };
 
-    // put into vec
-    for (auto it = rc.begin(); it != rc.end(); it++) rc_vec.push_back(it);
-    for (auto it = exception_rc.begin(); it != exception_rc.end(); it++)
-      rc_vec.push_back(it);
+    // replicas serve queries only, writes go to the owning process
+    if (rank.is_replica())
+      for (auto path : {"/put", "/bulk_put", "/incr?*", "/remove?uid={uint}"})
+        for (auto& method : rc[path])
+          method.second = [this](std::ostream& response, Request& request) {
+            response << "Read Only";
+          };
+
+    // compile routes, exception_rc only has catch-alls so it ranks last
+    router.compile(rc);
+    router.compile(exception_rc);
+
+    std::vector<std::pair<std::string, std::string>> routes;
+    for (rc_t* table : {&rc, &exception_rc})
+      for (auto& route : *table)
+        for (auto& method : route.second) {
+          route_of[&method.second] = routes.size();
+          routes.emplace_back(route.first, method.first);
+        }
+    metrics.set_routes(std::move(routes));
   }
 
-  void accept() {
-    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+  // One per connection, answering its requests in turn: pipelined ones
+  // straight from what is buffered, the rest as they arrive. The read and
+  // body buffers, the parser and the request are reused for every request.
+  // A response goes out in one gather write of its status line, the common
+  // headers and the body, none of them copied together.
+  // Its handlers run on its strand, so the idle timer can close the socket
+  // from any service thread. A deferred reply comes back onto the strand too;
+  // the session reads nothing more until it is written.
+  // The time spent parsing, in the handler and writing is recorded per route.
+  class Session : public std::enable_shared_from_this<Session> {
+   public:
+    Session(Server& server_, boost::asio::io_service& io)
+        : socket(io),
+          server(server_),
+          strand(io),
+          idle_timer(io),
+          body(&body_buffer) {
+      request.make_reply = [this]() {
+        auto self = shared_from_this();
+        return Request::reply_t([this, self](Request::body_t write) {
+          strand.post([this, self, write]() {
+            write(body);
+            send();
+          });
+        });
+      };
+    }
+
+    ~Session() {
+      if (started) server.metrics.connections--;
+    }
 
-    acceptor.async_accept(*socket,
-                          [this, socket](const boost::system::error_code& ec) {
-                            accept();
-                            if (!ec) process(socket);
-                          });
-  }
+    boost::asio::ip::tcp::socket socket;
 
-  void process(std::shared_ptr<boost::asio::ip::tcp::socket> socket) const {
-    auto read_buffer = std::make_shared<boost::asio::streambuf>();
-    boost::asio::async_read_until(
-        *socket, *read_buffer, "\r\n\r\n",
-        [this, socket, read_buffer](const boost::system::error_code& ec,
-                                    size_t bytes_transferred) {
-          if (ec) return;
-
-          // parse request
-          size_t total = read_buffer->size();
-          std::istream stream(read_buffer.get());
-          auto request = std::make_shared<Request>();
-          *request = parse_request(stream);
-
-          size_t num_additional_bytes = total - bytes_transferred;
-
-          // handle request
-          if (request->header.count("Content-Length") > 0) {
-            boost::asio::async_read(
-                *socket, *read_buffer,
-                boost::asio::transfer_exactly(
-                    stoull(request->header["Content-Length"]) -
-                    num_additional_bytes),
-                [this, socket, read_buffer, request](
-                    const boost::system::error_code& ec,
-                    size_t bytes_transferred) {
-                  if (!ec) {
-                    respond(socket, request);
-                  }
-                });
-          } else {
-            respond(socket, request);
-          }
-        });
-  }
+    void start() {
+      started = true;
+      server.metrics.connections++;
+      // responses to pipelined requests go out one by one, unbatched
+      boost::system::error_code ec;
+      socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+      wait_idle(server.idle_timeout);
+      next_request();
+    }
 
-  void respond(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-               std::shared_ptr<Request> request) const {
-    for (auto res_it : rc_vec) {
-      std::regex e(res_it->first);
-      std::smatch sm_res;
-      // path match
-      if (std::regex_match(request->path, sm_res, e)) {
-        // method match
-        if (res_it->second.count(request->method)) {
-          request->path_match = move(sm_res);
-
-          auto write_buffer = std::make_shared<boost::asio::streambuf>();
-          std::ostream response(write_buffer.get());
-          res_it->second[request->method](response, *request);
-
-          boost::asio::async_write(
-              *socket, *write_buffer,
-              [this, socket, request, write_buffer](
-                  const boost::system::error_code& ec,
-                  size_t bytes_transferred) {
-                if (!ec && stof(request->http_version) > 1.05) process(socket);
-              });
+   private:
+    Server& server;
+    bool started = false;
+    boost::asio::io_service::strand strand;
+    // Checks now and then how long the request being read has been
+    // awaited, so a request costs no timer update.
+    boost::asio::deadline_timer idle_timer;
+    bool awaiting = false;
+    boost::posix_time::ptime awaiting_since;
+    boost::asio::streambuf read_buffer, body_buffer;
+    // handlers write the body here
+    std::ostream body;
+    // status line and Content-Length
+    char head[64];
+    RequestParser parser;
+    Request request;
+    // a shared page being written
+    std::shared_ptr<const std::string> page;
+    // the request's route, its parse time so far, when parsing last stopped
+    // and when its write started
+    uint32_t route = 0;
+    Metrics::clock::duration parse_time;
+    Metrics::clock::time_point parse_end, write_start;
+
+    void next_request() {
+      parser.reset();
+      parse_time = Metrics::clock::duration::zero();
+      parse();
+    }
+
+    // parse what is already buffered first: a pipelined request may be there
+    void parse() {
+      const char* begin =
+          boost::asio::buffer_cast<const char*>(read_buffer.data());
+      auto parse_start = Metrics::clock::now();
+      auto status = parser.parse(begin, begin + read_buffer.size(), request);
+      parse_end = Metrics::clock::now();
+      parse_time += parse_end - parse_start;
+      switch (status) {
+        case RequestParser::Status::complete:
+          awaiting = false;
+          server.logger.line(log_level::info)
+              << request.method << " " << request.path << " HTTP/"
+              << request.http_version;
+          respond();
+          return;
+
+        case RequestParser::Status::bad:
+          // there is no way to find the next request
+          server.logger.line(log_level::warn) << "Bad HTTP request";
+          close();
+          return;
+
+        case RequestParser::Status::incomplete:
+          if (!awaiting) {
+            awaiting = true;
+            awaiting_since = now();
+          }
+          read();
           return;
-        }
       }
-      // continue
     }
-  }
 
-  Request parse_request(std::istream& stream) const {
-    Request request;
-    std::regex e("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-
-    std::smatch sub_match;
-
-    std::string line;
-    getline(stream, line);
-    std::cout << line << std::endl;
-
-    line.pop_back();
-    if (std::regex_match(line, sub_match, e)) {
-      request.method = sub_match[1];
-      request.path = sub_match[2];
-      request.http_version = sub_match[3];
-      bool matched;
-      e = "^([^:]*): ?(.*)$";
-      do {
-        getline(stream, line);
-        line.pop_back();
-        matched = std::regex_match(line, sub_match, e);
-        if (matched) {
-          request.header[sub_match[1]] = sub_match[2];
-        }
-      } while (matched == true);
+    void read() {
+      auto self = shared_from_this();
+      socket.async_read_some(
+          read_buffer.prepare(read_chunk),
+          strand.wrap([this, self](const boost::system::error_code& ec,
+                                   size_t bytes_transferred) {
+            if (ec) return close();
+            read_buffer.commit(bytes_transferred);
+            parse();
+          }));
+    }
+
+    static boost::posix_time::ptime now() {
+      return boost::posix_time::microsec_clock::universal_time();
     }
-    // body
-    if (!stream.eof()) getline(stream, request.content);
 
-    return request;
+    void wait_idle(boost::posix_time::time_duration timeout) {
+      auto self = shared_from_this();
+      idle_timer.expires_from_now(timeout);
+      idle_timer.async_wait(
+          strand.wrap([this, self](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto idle = awaiting ? now() - awaiting_since
+                                 : boost::posix_time::seconds(0);
+            if (idle >= server.idle_timeout) return close();
+            wait_idle(server.idle_timeout - idle);
+          }));
+    }
+
+    void respond() {
+      // path and method match
+      auto match = server.router.match(request.path, request.method);
+      if (!match.handler) {
+        server.logger.line(log_level::warn)
+            << "No route for " << request.method << " " << request.path;
+        return close();
+      }
+      request.path_param = match.param;
+      route = server.route_of.find(match.handler)->second;
+      server.metrics.in_flight++;
+      server.metrics.record(route, Metrics::parse, parse_time);
+
+      // routing counts as handler time, up to the reply of a deferred one
+      request.deferred = false;
+      try {
+        (*match.handler)(body, request);
+      } catch (const std::runtime_error& e) {
+        // a replica whose owner left: it has nothing left to serve
+        server.logger.line(log_level::error) << e.what();
+        server.metrics.in_flight--;
+        server.stop();
+        return close();
+      }
+      if (!request.deferred) send();
+    }
+
+    void send() {
+      write_start = Metrics::clock::now();
+      server.metrics.record(route, Metrics::handle, write_start - parse_end);
+
+      // request views die with the consumed bytes
+      bool keep = keep_alive(request);
+      read_buffer.consume(parser.consumed());
+
+      boost::asio::const_buffer content = body_buffer.data();
+      if (request.shared_response) {
+        page = std::move(request.shared_response);
+        content = boost::asio::buffer(*page);
+      }
+      int head_len = snprintf(head, sizeof(head),
+                              "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n",
+                              boost::asio::buffer_size(content));
+      std::array<boost::asio::const_buffer, 3> buffers = {
+          {boost::asio::buffer(head, head_len), common_headers(), content}};
+
+      auto self = shared_from_this();
+      boost::asio::async_write(
+          socket, buffers,
+          strand.wrap([this, self, keep](const boost::system::error_code& ec,
+                                         size_t bytes_transferred) {
+            server.metrics.record(route, Metrics::write,
+                                  Metrics::clock::now() - write_start);
+            server.metrics.in_flight--;
+            body_buffer.consume(body_buffer.size());
+            page.reset();
+            if (ec || !keep) return close();
+            next_request();
+          }));
+    }
+
+    void close() {
+      boost::system::error_code ec;
+      idle_timer.cancel(ec);
+      socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+      socket.close(ec);
+    }
+  };
+
+  void accept(Loop& loop) {
+    auto session = std::make_shared<Session>(*this, loop.io);
+
+    loop.acceptor.async_accept(
+        session->socket,
+        [this, &loop, session](const boost::system::error_code& ec) {
+          accept(loop);
+          if (!ec) session->start();
+        });
+  }
+
+  static std::vector<std::unique_ptr<Loop>> make_loops(
+      const boost::asio::ip::tcp::endpoint& endpoint, threading model,
+      uint32_t service_cnt) {
+    std::vector<std::unique_ptr<Loop>> loops;
+    if (model == threading::shared)
+      loops.emplace_back(new Loop(endpoint, service_cnt, false));
+    else
+      for (uint32_t i = 0; i < std::max(service_cnt, 1u); i++)
+        loops.emplace_back(new Loop(endpoint, 1, true));
+    return loops;
+  }
+
+  // keeps the calling thread on core
+  static void pin_to_core(unsigned core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
   }
 
   inline void join_all_thread() {
@@ -322,33 +719,75 @@ class Server {
   }
 
   void config() {
-    config_json();
     config_rc();
     config_signal();
+    config_checkpoint();
+    config_windows();
   }
 
  public:
-  Server(uint32_t port, u_int32_t service_cnt_ = 1)
+  // data_file: keep the users in this file across restarts instead of in
+  // shared memory. replica: serve queries from the leaderboard another
+  // server process owns, in data_file or in shared memory. model: how the
+  // service_cnt threads share connections. weights: of the hybrid score, a
+  // replica answers with its owner's.
+  Server(uint32_t port, u_int32_t service_cnt_ = 1,
+         const std::string& data_file = "", bool replica = false,
+         threading model_ = threading::shared,
+         const HybridWeights& weights = HybridWeights())
       : endpoint(boost::asio::ip::tcp::v4(), port),
-        acceptor(io_service, endpoint),
-        signals(io_service),
-        work(io_service),
+        model(model_),
+        loops(make_loops(endpoint, model, service_cnt_)),
+        signals(loops.front()->io),
         service_cnt(service_cnt_),
-        main_thread_id(std::this_thread::get_id()) {}
+        main_thread_id(std::this_thread::get_id()),
+        checkpoint_timer(loops.front()->io),
+        window_timer(loops.front()->io),
+        logger(std::cout),
+        rank_ptr(replica ? new Ranking(boost::interprocess::open_only, data_file)
+                         : new Ranking(1 << 20, rank_mode::competition,
+                                       weights, data_file)),
+        rank(*rank_ptr),
+        writer(rank),
+        page_cache(rank) {}
 
   void start() {
     config();
 
-    accept();
-
-    for (uint32_t i = 0; i < service_cnt; i++) {
-      threads.emplace_back([this]() { io_service.run(); });
+    for (auto& loop : loops) accept(*loop);
+
+    if (model == threading::shared) {
+      for (uint32_t i = 0; i < service_cnt; i++)
+        threads.emplace_back([this]() { loops.front()->io.run(); });
+    } else {
+      unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+      for (uint32_t i = 0; i < loops.size(); i++)
+        threads.emplace_back([this, i, cores]() {
+          pin_to_core(i % cores);
+          loops[i]->io.run();
+        });
     }
 
     // io_service.run();
 
     join_all_thread();
   }
+
+  // Scores activity in windows of period seconds, offset seconds into each
+  // period since the Unix epoch: 86400 and 0 for days in UTC, 604800 and
+  // 345600 for weeks from Monday. Set before start().
+  void set_windows(uint32_t period, uint32_t offset = 0) {
+    window_period = period;
+    window_offset = period ? offset % period : 0;
+  }
+
+  // level and sampling can be changed while serving
+  Logger& get_logger() { return logger; }
+
+  // start() returns once the service threads have left their handlers
+  void stop() {
+    for (auto& loop : loops) loop->io.stop();
+  }
 };
 
 #endif  // !_SERVER_HPP_
@@ -10,8 +10,7 @@ static User generate_random_user(uint32_t uid_, char_allocator& ca) {
   User user(ca);
   user.uid = uid_;
   user.name = shm_string(std::to_string(rd()).c_str(), ca);
-  user.exp_pers = rd();
-  user.activity = rd();
+  for (auto& score : user.scores) score = rd();
   return user;
 }
 
@@ -24,8 +23,8 @@ static inline void init_rank(Ranking& rank, uint32_t size) {
     rank.put_user(generate_random_user(i, rank.get_ca()));
 }
 
-static void init_env_uid(uint32_t size, uint32_t iter_cnt, Ranking& rank,
-                         std::set<uint32_t>& test_data) {
+static inline void init_env_uid(uint32_t size, uint32_t iter_cnt,
+                                Ranking& rank, std::set<uint32_t>& test_data) {
   init_rank(rank, size);
   for (auto _ : boost::irange(iter_cnt)) {
     (void)_;
@@ -1,5 +1,6 @@
 #include <benchmark/benchmark.h>
 
+#include "page_cache.hpp"
 #include "ranking.hpp"
 #include "test.h"
 
@@ -10,6 +11,13 @@ static void Args_basic(benchmark::internal::Benchmark* b) {
   for (auto i : boost::irange(10, 20)) b->Args({1 << i, 100});
 }
 
+static void Args_mode(benchmark::internal::Benchmark* b) {
+  for (auto mode : {rank_mode::competition, rank_mode::dense,
+                    rank_mode::ordinal})
+    for (auto i : boost::irange(10, 20))
+      b->Args({1 << i, 100, static_cast<int>(mode)});
+}
+
 #ifdef BM_CRUD
 
 static void BM_put_user(benchmark::State& state) {
@@ -78,6 +86,140 @@ static void BM_remove_user(benchmark::State& state) {
 }
 BENCHMARK(BM_remove_user)->Apply(Args_basic);
 
+// filling from the 1 MiB default, growing the segment on the way, against a
+// segment sized up front
+static void BM_fill_users(benchmark::State& state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  uint64_t mem_size = state.range(1) ? (1 << 20) + size * 512ull : 1 << 20;
+
+  // timing part
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Ranking> rank(new Ranking(mem_size));
+    state.ResumeTiming();
+    for (auto i : boost::irange(size))
+      rank->put_user(User(i, {i, i}, "fill", rank->get_ca()));
+    state.PauseTiming();
+    rank.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_fill_users)->ArgsProduct({{1 << 12, 1 << 16}, {0, 1}});
+
+// Segment allocations per put, from building the User the way /put does to
+// linking it: copied in, moved in, or built in its node. Names of 12 chars
+// are kept inline, names of 40 are not.
+static void BM_put_user_allocs(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  uint32_t size = state.range(0), iter_cnt = state.range(1);
+  int how = state.range(2);
+  std::string name(state.range(3), 'n');
+  init_rank(rank, size);
+  uint32_t uid = size;
+  uint64_t puts = 0, before = rank.get_segment_stats().allocations;
+
+  // timing part
+  for (auto _ : state) {
+    for (auto _ : boost::irange(iter_cnt)) {
+      (void)_;
+      uid++;
+      if (how == 0) {
+        User user(uid, {uid, uid}, name, rank.get_ca());
+        rank.put_user(user);
+      } else if (how == 1) {
+        rank.put_user(User(uid, {uid, uid}, name, rank.get_ca()));
+      } else {
+        rank.emplace_user(uid, {uid, uid}, name);
+      }
+    }
+    puts += iter_cnt;
+  }
+  state.counters["allocs_per_put"] =
+      double(rank.get_segment_stats().allocations - before) / puts;
+}
+BENCHMARK(BM_put_user_allocs)
+    ->ArgsProduct({{1 << 16}, {100}, {0, 1, 2}, {12, 40}});
+
+// modify changing a single score, the other two indices stay put
+static void BM_modify_activity(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  std::mt19937 gen(0);
+  std::vector<User> users;
+  for (auto uid : test_data)
+    users.push_back(rank.with_user(uid, [](const User& user) { return user; }));
+
+  // timing part
+  for (auto _ : state) {
+    for (auto& user : users) {
+      user.score<tag_activity>() = gen();
+      rank.modify_user(user);
+    }
+  }
+}
+BENCHMARK(BM_modify_activity)->Apply(Args_basic);
+
+// the same change as an incr, which reads the user under the write lock
+static void BM_incr_activity(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  std::mt19937 gen(0);
+  std::vector<User> users;
+  for (auto uid : test_data)
+    users.push_back(rank.with_user(uid, [](const User& user) { return user; }));
+  users[0].score<tag_activity>() = UINT32_MAX - 5;
+  rank.modify_user(users[0]);
+
+  // timing part
+  for (auto _ : state) {
+    for (auto& user : users) {
+      uint32_t delta = gen() % 16 + 1;
+      rank.incr_user(user.uid, delta_of<tag_activity>(delta));
+      uint32_t& activity = user.score<tag_activity>();
+      activity = UINT32_MAX - activity < delta ? UINT32_MAX : activity + delta;
+    }
+  }
+
+  // the sums saturate, the other scores stay
+  for (auto& user : users)
+    if (rank.with_user(user.uid, [](const User& u) { return u.scores; }) !=
+        user.scores) {
+      state.SkipWithError("an incr lost or misplaced its delta");
+      break;
+    }
+}
+BENCHMARK(BM_incr_activity)->Apply(Args_basic);
+
+// modify gaining activity, with the windows scoring it (1) or not (0)
+static void BM_modify_activity_windowed(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  if (state.range(2)) rank.track_windows();
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  std::mt19937 gen(0);
+  std::vector<User> users;
+  for (auto uid : test_data)
+    users.push_back(rank.with_user(uid, [](const User& user) { return user; }));
+
+  // timing part
+  for (auto _ : state) {
+    for (auto& user : users) {
+      user.score<tag_activity>() += gen() % 16 + 1;
+      rank.modify_user(user);
+    }
+  }
+}
+BENCHMARK(BM_modify_activity_windowed)
+    ->ArgsProduct({{1 << 10, 1 << 14, 1 << 18}, {100}, {0, 1}});
+
 #endif  // BM_CRUD
 
 #ifdef BM_RANK
@@ -121,6 +263,195 @@ static void BM_get_hybrid_rank(benchmark::State& state) {
 }
 BENCHMARK(BM_get_hybrid_rank)->Apply(Args_basic);
 
+// Six users on exp_pers 9 9 7 7 7 3, put in reverse uid order: ties share
+// the first rank of their run in competition mode, count the distinct scores
+// above in dense mode and go by uid in ordinal mode.
+static bool ranks_ties(rank_mode mode) {
+  static const uint32_t expected[][6] = {
+      {0, 0, 2, 2, 2, 5}, {0, 0, 1, 1, 1, 2}, {0, 1, 2, 3, 4, 5}};
+  static const uint32_t exp_pers[] = {9, 9, 7, 7, 7, 3};
+  Ranking rank(1 << 20, mode);
+  for (uint32_t uid = 6; uid-- > 0;)
+    rank.put_user(User(uid, {exp_pers[uid], 0}, "tie", rank.get_ca()));
+  for (uint32_t uid = 0; uid < 6; uid++)
+    if (rank.get_exp_pers_rank(uid) != expected[static_cast<int>(mode)][uid])
+      return false;
+  return true;
+}
+
+static void BM_get_exp_pers_rank_by_mode(benchmark::State& state) {
+  // pre-set part
+  if (!ranks_ties(static_cast<rank_mode>(state.range(2)))) {
+    state.SkipWithError("ties ranked against the mode");
+    return;
+  }
+  Ranking rank(1 << 20, static_cast<rank_mode>(state.range(2)));
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+
+  // timing part
+  for (auto _ : state) {
+    for (auto data : test_data) rank.get_exp_pers_rank(data);
+  }
+}
+BENCHMARK(BM_get_exp_pers_rank_by_mode)->Apply(Args_mode);
+
+// the three ranks of a user, one call per index
+static void BM_get_three_ranks(benchmark::State& state) {
+  // pre-set part
+  Ranking rank(1 << 20, static_cast<rank_mode>(state.range(2)));
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+
+  // timing part
+  for (auto _ : state) {
+    for (auto data : test_data) {
+      benchmark::DoNotOptimize(rank.get_exp_pers_rank(data));
+      benchmark::DoNotOptimize(rank.get_activity_rank(data));
+      benchmark::DoNotOptimize(rank.get_hybrid_rank(data));
+    }
+  }
+}
+BENCHMARK(BM_get_three_ranks)->Apply(Args_mode);
+
+// and from a single all_ranks
+static void BM_all_ranks(benchmark::State& state) {
+  // pre-set part
+  Ranking rank(1 << 20, static_cast<rank_mode>(state.range(2)));
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+
+  // timing part
+  for (auto _ : state) {
+    for (auto data : test_data) benchmark::DoNotOptimize(rank.all_ranks(data));
+  }
+}
+BENCHMARK(BM_all_ranks)->Apply(Args_mode);
+
+static void BM_get_exp_pers_range(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  uint64_t sum = 0;
+
+  // timing part
+  // pages of 10 starting at random offsets
+  for (auto _ : state) {
+    for (auto data : test_data)
+      rank.range<tag_exp_pers>(data, 10, [&sum](uint32_t, const User& user) {
+        sum += user.score<tag_exp_pers>();
+      });
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_get_exp_pers_range)->Apply(Args_basic);
+
+static void BM_get_exp_pers_page_cached(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  PageCache cache(rank);
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  auto render = [](Ranking::View& view, std::ostream& out) {
+    view.range<tag_exp_pers>(0, 10, [&out](uint32_t r, const User& user) {
+      out << r << user;
+    });
+  };
+
+  // timing part
+  // the top page, with one random modify in ten
+  uint32_t i = 0;
+  for (auto _ : state) {
+    for (auto data : test_data) {
+      if (++i % 10 == 0)
+        rank.modify_user(generate_random_user(data, rank.get_ca()));
+      benchmark::DoNotOptimize(cache.get<tag_exp_pers>(0, 10, render));
+    }
+  }
+
+  // the top user dropping off the page must show on it
+  User top = rank.read_batch([&rank](Ranking::View& view) {
+    User user(rank.get_ca());
+    view.range<tag_exp_pers>(0, 1, [&user](uint32_t, const User& first) {
+      user = first;
+    });
+    return user;
+  });
+  top.score<tag_exp_pers>() = 0;
+  rank.modify_user(top);
+  std::ostringstream fresh;
+  rank.read_batch([&](Ranking::View& view) { render(view, fresh); });
+  if (*cache.get<tag_exp_pers>(0, 10, render) != fresh.str())
+    state.SkipWithError("a modify left a stale top page");
+
+  rank.clear();
+  if (!cache.get<tag_exp_pers>(0, 10, render)->empty())
+    state.SkipWithError("a cleared ranking served its old top page");
+}
+BENCHMARK(BM_get_exp_pers_page_cached)->Apply(Args_basic);
+
+// puts leave the windows alone, so every user gains some activity in the
+// current one
+static void score_window(Ranking& rank, uint32_t size) {
+  std::mt19937 gen(0);
+  for (auto uid : boost::irange(size))
+    rank.incr_user(uid, delta_of<tag_activity>(gen() % 16 + 1));
+}
+
+// rollovers after all users scored in a window, at the same cost whatever
+// the size of the boards
+static void BM_start_window(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  rank.track_windows();
+  std::set<uint32_t> test_data;
+  init_env_uid(state.range(0), state.range(1), rank, test_data);
+  score_window(rank, state.range(0));
+  uint32_t window = rank.current_window();
+
+  // the current ranks become the last ones
+  std::vector<uint32_t> ranks;
+  for (auto uid : test_data)
+    ranks.push_back(rank.get_rank<tag_this_window>(uid));
+  rank.start_window(++window);
+  auto last = ranks.begin();
+  for (auto uid : test_data)
+    if (rank.get_rank<tag_last_window>(uid) != *last++) {
+      state.SkipWithError("a rollover moved the window ranks");
+      return;
+    }
+
+  // timing part
+  for (auto _ : state) rank.start_window(++window);
+}
+BENCHMARK(BM_start_window)->Apply(Args_basic);
+
+static void BM_get_window_rank(benchmark::State& state) {
+  // pre-set part
+  Ranking rank;
+  rank.track_windows();
+  std::set<uint32_t> test_data;
+  uint32_t size = state.range(0);
+  init_env_uid(size, state.range(1), rank, test_data);
+  score_window(rank, size);
+
+  // a new user has gained nothing in the window, whatever its activity
+  uint32_t probe = *test_data.begin();
+  uint32_t before = rank.get_rank<tag_this_window>(probe);
+  rank.put_user(User(size, {0, UINT32_MAX}, "fresh", rank.get_ca()));
+  if (rank.get_rank<tag_this_window>(probe) != before ||
+      rank.get_rank<tag_this_window>(size) <= before)
+    state.SkipWithError("a put moved the window ranks");
+
+  // timing part
+  for (auto _ : state) {
+    for (auto data : test_data)
+      benchmark::DoNotOptimize(rank.get_rank<tag_this_window>(data));
+  }
+}
+BENCHMARK(BM_get_window_rank)->Apply(Args_basic);
+
 #endif  // BM_RANK
 
 BENCHMARK_MAIN();
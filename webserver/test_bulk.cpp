@@ -0,0 +1,115 @@
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "bulk_loader.hpp"
+#include "ranking.hpp"
+
+// Cold loading a leaderboard from an NDJSON dump in shuffled uid order: one
+// /put per user, parsed and put one by one, against parse_bulk on every core
+// and a hinted bulk_put. Arg 1 picks the binary records instead for the bulk
+// path.
+static std::string make_dump(uint32_t size, bool binary) {
+  std::mt19937 gen(0);
+  std::vector<uint32_t> uids(size);
+  for (uint32_t i = 0; i < size; i++) uids[i] = i;
+  std::shuffle(uids.begin(), uids.end(), gen);
+
+  std::ostringstream out;
+  if (binary) out.write(bulk_magic, sizeof(bulk_magic));
+  for (auto uid : uids) {
+    std::string name = "user" + std::to_string(uid);
+    uint32_t exp_pers = gen(), activity = gen();
+    if (binary) {
+      for (uint32_t v : {uid, exp_pers, activity})
+        for (int i = 0; i < 4; i++) out.put(static_cast<char>(v >> (8 * i)));
+      out.put(static_cast<char>(name.size()));
+      out.put(static_cast<char>(name.size() >> 8));
+      out << name;
+    } else {
+      out << "{\"uid\":" << uid << ",\"name\":\"" << name
+          << "\",\"exp_pers\":" << exp_pers << ",\"activity\":" << activity
+          << "}\n";
+    }
+  }
+  return out.str();
+}
+
+static void BM_load_one_by_one(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::string dump = make_dump(size, false);
+
+  // timing part
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Ranking> rank(new Ranking());
+    state.ResumeTiming();
+    UserParser parser;
+    UserFields fields;
+    std::istringstream in(dump);
+    for (std::string line; std::getline(in, line);) {
+      parser.parse(line, fields);
+      rank->put_user(
+          User(fields.uid, fields.scores, fields.name, rank->get_ca()));
+    }
+    state.PauseTiming();
+    rank.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_load_one_by_one)
+    ->Args({1 << 14})
+    ->Args({1 << 18})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_load_bulk(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::string dump = make_dump(size, state.range(1));
+
+  // timing part
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Ranking> rank(new Ranking());
+    state.ResumeTiming();
+    BulkRecords records;
+    uint64_t bad_at;
+    parse_bulk(dump, records, bad_at, std::thread::hardware_concurrency());
+    if (rank->bulk_put(records.users.begin(), records.users.end()) != size)
+      state.SkipWithError("users lost");
+    state.PauseTiming();
+    rank.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_load_bulk)
+    ->ArgsProduct({{1 << 14, 1 << 18}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+// parse_bulk alone
+static void BM_parse_bulk(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::string dump = make_dump(size, state.range(1));
+
+  // timing part
+  for (auto _ : state) {
+    BulkRecords records;
+    uint64_t bad_at;
+    parse_bulk(dump, records, bad_at, std::thread::hardware_concurrency());
+    benchmark::DoNotOptimize(records.users.data());
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+  state.SetBytesProcessed(state.iterations() * dump.size());
+}
+BENCHMARK(BM_parse_bulk)
+    ->ArgsProduct({{1 << 18}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,209 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <thread>
+
+#include "batch_writer.hpp"
+#include "ranking.hpp"
+
+// One Ranking shared by every thread of a run, like the io_service threads
+// in Server. Thread 0 sets it up before the timing loop and checks it after.
+static Ranking *shared_rank;
+static const uint32_t preset_size = 1 << 16;
+
+static void Args_threads(benchmark::internal::Benchmark *b) {
+  b->ThreadRange(1, 2 * std::max(1u, std::thread::hardware_concurrency()))
+      ->UseRealTime();
+}
+
+static void setup(benchmark::State &state) {
+  if (state.thread_index() != 0) return;
+  shared_rank = new Ranking(1 << 28);
+  std::mt19937 gen(0);
+  for (uint32_t i = 0; i < preset_size; i++) {
+    uint32_t exp_pers = gen(), activity = gen();
+    shared_rank->put_user(
+        User(i, {exp_pers, activity}, "preset", shared_rank->get_ca()));
+  }
+}
+
+static void teardown(benchmark::State &state) {
+  if (state.thread_index() != 0) return;
+  delete shared_rank;
+  shared_rank = nullptr;
+}
+
+static void BM_concurrent_rank(benchmark::State &state) {
+  setup(state);
+  std::mt19937 gen(state.thread_index());
+
+  // timing part
+  for (auto _ : state) {
+    uint32_t uid = gen() % preset_size;
+    benchmark::DoNotOptimize(shared_rank->get_exp_pers_rank(uid));
+  }
+  state.SetItemsProcessed(state.iterations());
+  teardown(state);
+}
+BENCHMARK(BM_concurrent_rank)->Apply(Args_threads);
+
+// 1 write in 10
+static void BM_concurrent_mixed(benchmark::State &state) {
+  setup(state);
+  std::mt19937 gen(state.thread_index());
+
+  // timing part
+  // shared_rank is only there once the loop starts
+  for (auto _ : state) {
+    uint32_t uid = gen() % preset_size;
+    if (gen() % 10) {
+      benchmark::DoNotOptimize(shared_rank->get_activity_rank(uid));
+    } else {
+      uint32_t exp_pers = gen(), activity = gen();
+      shared_rank->modify_user(
+          User(uid, {exp_pers, activity}, {}, shared_rank->get_ca()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  teardown(state);
+}
+BENCHMARK(BM_concurrent_mixed)->Apply(Args_threads);
+
+// Stress: every thread puts and removes its own uids while ranking queries
+// run against the preset users. Anything lost or duplicated by a race shows
+// up in the size once all threads pass the end of the timing loop.
+static void BM_concurrent_stress(benchmark::State &state) {
+  setup(state);
+  std::mt19937 gen(state.thread_index());
+  uint32_t uid = preset_size * (state.thread_index() + 1);
+
+  // timing part
+  for (auto _ : state) {
+    uint32_t exp_pers = gen(), activity = gen();
+    shared_rank->put_user(
+        User(uid, {exp_pers, activity}, "stress", shared_rank->get_ca()));
+    benchmark::DoNotOptimize(
+        shared_rank->get_hybrid_rank(gen() % preset_size));
+    shared_rank->remove_user(uid);
+  }
+
+  if (state.thread_index() == 0 && shared_rank->get_size() != preset_size)
+    state.SkipWithError("size mismatch after concurrent put/remove");
+  state.SetItemsProcessed(state.iterations());
+  teardown(state);
+}
+BENCHMARK(BM_concurrent_stress)->Apply(Args_threads);
+
+// Sustained writes: each iteration is a burst of puts on fresh uids, applied
+// either directly by the calling thread or through the batch writer. As in
+// every benchmark here, shared_rank and shared_writer are only touched once
+// the timing loop has started.
+static const uint32_t burst = 64;
+
+static void BM_direct_put(benchmark::State &state) {
+  setup(state);
+  std::mt19937 gen(state.thread_index());
+  uint32_t uid = preset_size * (state.thread_index() + 1);
+
+  // timing part
+  for (auto _ : state) {
+    for (uint32_t i = 0; i < burst; i++) {
+      uint32_t exp_pers = gen(), activity = gen();
+      shared_rank->put_user(
+          User(uid++, {exp_pers, activity}, {}, shared_rank->get_ca()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+  teardown(state);
+}
+BENCHMARK(BM_direct_put)->Apply(Args_threads);
+
+static BatchWriter *shared_writer;
+
+static void BM_batched_put(benchmark::State &state) {
+  setup(state);
+  if (state.thread_index() == 0) shared_writer = new BatchWriter(*shared_rank);
+  std::mt19937 gen(state.thread_index());
+  uint32_t uid = preset_size * (state.thread_index() + 1);
+  std::atomic<uint32_t> done{0};
+
+  // timing part
+  for (auto _ : state) {
+    done.store(0);
+    for (uint32_t i = 0; i < burst; i++) {
+      uint32_t exp_pers = gen(), activity = gen();
+      shared_writer->put(
+          User(uid++, {exp_pers, activity}, {}, shared_rank->get_ca()),
+          [&done](bool, std::exception_ptr) { done++; });
+    }
+    while (done.load() != burst) std::this_thread::yield();
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+  if (state.thread_index() == 0) delete shared_writer;
+  teardown(state);
+}
+BENCHMARK(BM_batched_put)->Apply(Args_threads);
+
+// Score events on range(0) hot users: each iteration is a burst of incrs,
+// applied directly or through the batch writer, which sums the ones of a uid
+// that share a batch. moves_per_incr counts the writes that moved nodes.
+static uint64_t write_version() {
+  return shared_rank->read_batch(
+      [](Ranking::View &view) { return view.version(); });
+}
+
+static void report_moves(benchmark::State &state, uint64_t before) {
+  if (state.thread_index() != 0) return;
+  state.counters["moves_per_incr"] =
+      double(write_version() - before) /
+      (state.iterations() * burst * state.threads());
+}
+
+static void Args_hot(benchmark::internal::Benchmark *b) {
+  for (auto hot_users : {16, 4096}) b->Arg(hot_users);
+  Args_threads(b);
+}
+
+static void BM_direct_incr(benchmark::State &state) {
+  setup(state);
+  std::mt19937 gen(state.thread_index());
+  uint32_t hot_users = state.range(0);
+  uint64_t before = state.thread_index() == 0 ? write_version() : 0;
+
+  // timing part
+  for (auto _ : state) {
+    for (uint32_t i = 0; i < burst; i++)
+      shared_rank->incr_user(gen() % hot_users,
+                             delta_of<tag_exp_pers>(gen() % 100 + 1));
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+  report_moves(state, before);
+  teardown(state);
+}
+BENCHMARK(BM_direct_incr)->Apply(Args_hot);
+
+static void BM_batched_incr(benchmark::State &state) {
+  setup(state);
+  if (state.thread_index() == 0) shared_writer = new BatchWriter(*shared_rank);
+  std::mt19937 gen(state.thread_index());
+  uint32_t hot_users = state.range(0);
+  uint64_t before = state.thread_index() == 0 ? write_version() : 0;
+  std::atomic<uint32_t> done{0};
+
+  // timing part
+  for (auto _ : state) {
+    done.store(0);
+    for (uint32_t i = 0; i < burst; i++)
+      shared_writer->incr(gen() % hot_users,
+                          delta_of<tag_exp_pers>(gen() % 100 + 1),
+                          [&done](bool, std::exception_ptr) { done++; });
+    while (done.load() != burst) std::this_thread::yield();
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+  report_moves(state, before);
+  if (state.thread_index() == 0) delete shared_writer;
+  teardown(state);
+}
+BENCHMARK(BM_batched_incr)->Apply(Args_hot);
+
+BENCHMARK_MAIN();
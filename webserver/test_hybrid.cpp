@@ -0,0 +1,161 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/ranked_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/range/irange.hpp>
+#include <random>
+#include <vector>
+
+// hybrid_index before and after materializing the key: the old one converts
+// both scores to double on every comparison, the new one compares a stored
+// integer. Only the index under test is kept, next to the uid index, and
+// both are ranked_non_unique on the bare score so the (score, uid) tie-break
+// Ranking adds on top does not blur the comparison.
+
+struct Scores {
+  uint32_t uid;
+  uint32_t exp_pers;
+  uint32_t activity;
+  uint64_t hybrid;
+
+  uint32_t by_float_hybrid() const { return exp_pers * 0.7 + activity * 0.3; }
+};
+
+struct tag_uid {};
+struct tag_hybrid {};
+
+using namespace boost::multi_index;
+
+typedef multi_index_container<
+    Scores,
+    indexed_by<ranked_non_unique<tag<tag_hybrid>,
+                                 const_mem_fun<Scores, uint32_t,
+                                               &Scores::by_float_hybrid>,
+                                 std::greater<uint32_t>>,
+               ordered_unique<tag<tag_uid>,
+                              member<Scores, uint32_t, &Scores::uid>>>>
+    float_container_t;
+
+typedef multi_index_container<
+    Scores,
+    indexed_by<ranked_non_unique<tag<tag_hybrid>,
+                                 member<Scores, uint64_t, &Scores::hybrid>,
+                                 std::greater<uint64_t>>,
+               ordered_unique<tag<tag_uid>,
+                              member<Scores, uint32_t, &Scores::uid>>>>
+    fixed_container_t;
+
+static uint64_t fixed_hybrid(const Scores& s) {
+  return static_cast<uint64_t>(s.exp_pers) * 700 +
+         static_cast<uint64_t>(s.activity) * 300;
+}
+
+static void Args_hybrid(benchmark::internal::Benchmark* b) {
+  for (auto i : boost::irange(10, 21, 2)) b->Args({1 << i, 100});
+}
+
+template <typename Container>
+static void fill(Container& users, uint32_t size, std::mt19937& gen) {
+  for (auto i : boost::irange(size)) {
+    uint32_t exp_pers = gen(), activity = gen();
+    Scores s{i, exp_pers, activity, 0};
+    s.hybrid = fixed_hybrid(s);
+    users.insert(s);
+  }
+}
+
+static void BM_get_hybrid_rank_float(benchmark::State& state) {
+  // pre-set part
+  std::mt19937 gen(0);
+  float_container_t users;
+  uint32_t size = state.range(0);
+  fill(users, size, gen);
+  auto& uid_index = users.get<tag_uid>();
+  auto& hybrid_index = users.get<tag_hybrid>();
+  std::vector<uint32_t> test_data;
+  for (auto _ : boost::irange(state.range(1))) {
+    (void)_;
+    test_data.push_back(gen() % size);
+  }
+
+  // timing part
+  for (auto _ : state) {
+    for (auto uid : test_data)
+      benchmark::DoNotOptimize(
+          hybrid_index.find_rank(uid_index.find(uid)->by_float_hybrid()));
+  }
+}
+BENCHMARK(BM_get_hybrid_rank_float)->Apply(Args_hybrid);
+
+static void BM_get_hybrid_rank_fixed(benchmark::State& state) {
+  // pre-set part
+  std::mt19937 gen(0);
+  fixed_container_t users;
+  uint32_t size = state.range(0);
+  fill(users, size, gen);
+  auto& uid_index = users.get<tag_uid>();
+  auto& hybrid_index = users.get<tag_hybrid>();
+  std::vector<uint32_t> test_data;
+  for (auto _ : boost::irange(state.range(1))) {
+    (void)_;
+    test_data.push_back(gen() % size);
+  }
+
+  // timing part
+  for (auto _ : state) {
+    for (auto uid : test_data)
+      benchmark::DoNotOptimize(
+          hybrid_index.find_rank(uid_index.find(uid)->hybrid));
+  }
+}
+BENCHMARK(BM_get_hybrid_rank_fixed)->Apply(Args_hybrid);
+
+static void BM_modify_hybrid_float(benchmark::State& state) {
+  // pre-set part
+  std::mt19937 gen(0);
+  float_container_t users;
+  uint32_t size = state.range(0);
+  fill(users, size, gen);
+  auto& uid_index = users.get<tag_uid>();
+
+  // timing part
+  for (auto _ : state) {
+    for (auto _ : boost::irange(state.range(1))) {
+      (void)_;
+      uint32_t exp_pers = gen(), activity = gen();
+      uid_index.modify(uid_index.find(gen() % size), [&](Scores& s) {
+        s.exp_pers = exp_pers;
+        s.activity = activity;
+      });
+    }
+  }
+}
+BENCHMARK(BM_modify_hybrid_float)->Apply(Args_hybrid);
+
+static void BM_modify_hybrid_fixed(benchmark::State& state) {
+  // pre-set part
+  std::mt19937 gen(0);
+  fixed_container_t users;
+  uint32_t size = state.range(0);
+  fill(users, size, gen);
+  auto& uid_index = users.get<tag_uid>();
+
+  // timing part
+  for (auto _ : state) {
+    for (auto _ : boost::irange(state.range(1))) {
+      (void)_;
+      uint32_t exp_pers = gen(), activity = gen();
+      uid_index.modify(uid_index.find(gen() % size), [&](Scores& s) {
+        s.exp_pers = exp_pers;
+        s.activity = activity;
+        s.hybrid = fixed_hybrid(s);
+      });
+    }
+  }
+}
+BENCHMARK(BM_modify_hybrid_fixed)->Apply(Args_hybrid);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <mutex>
+
+#include "logger.hpp"
+
+// A request line logged through the rings against the std::cout way it was
+// logged before: a shared stream, its lock and a flush per line. Both write
+// to /dev/null.
+static std::ofstream devnull("/dev/null");
+static Logger logger(devnull);
+
+static const boost::string_view method = "GET", path = "/info?uid=1",
+                                version = "1.1";
+
+static void BM_log_line(benchmark::State &state) {
+  for (auto _ : state) {
+    logger.line(log_level::info)
+        << method << " " << path << " HTTP/" << version;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_log_line)->ThreadRange(1, 8);
+
+// below the level: the cost of logging off
+static void BM_log_skipped(benchmark::State &state) {
+  for (auto _ : state) {
+    logger.line(log_level::debug)
+        << method << " " << path << " HTTP/" << version;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_log_skipped);
+
+static void BM_stream_line(benchmark::State &state) {
+  static std::ofstream out("/dev/null");
+  static std::mutex mtx;
+  for (auto _ : state) {
+    std::lock_guard<std::mutex> lock(mtx);
+    out << method << " " << path << " HTTP/" << version << std::endl;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_stream_line)->ThreadRange(1, 8);
+
+BENCHMARK_MAIN();
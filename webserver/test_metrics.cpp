@@ -0,0 +1,64 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <sstream>
+
+#include "metrics.hpp"
+
+// What a request pays for its metrics: three records, each on the shard of
+// the recording thread, and the clock reads around the phases.
+static Metrics metrics;
+
+static void set_routes() {
+  std::vector<std::pair<std::string, std::string>> routes;
+  for (auto path : {"/info?uid={uint}", "/put", "/bulk_put",
+                    "/remove?uid={uint}", "/get_exp_pers?uid={uint}",
+                    "/get_activity?uid={uint}", "/top?*", "/metrics"})
+    routes.emplace_back(path, "GET");
+  metrics.set_routes(routes);
+}
+
+static void BM_record(benchmark::State &state) {
+  // pre-set part
+  std::mt19937 gen(state.thread_index());
+  std::vector<Metrics::clock::duration> latencies(1024);
+  for (auto &l : latencies) l = std::chrono::nanoseconds(gen() % 1000000);
+
+  // timing part
+  size_t i = 0;
+  for (auto _ : state) {
+    auto l = latencies[i++ & 1023];
+    metrics.record(i & 7, Metrics::parse, l);
+    metrics.record(i & 7, Metrics::handle, l);
+    metrics.record(i & 7, Metrics::write, l);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_record)->ThreadRange(1, 8);
+
+// four clock reads per request
+static void BM_clock(benchmark::State &state) {
+  for (auto _ : state) {
+    for (int i = 0; i < 4; i++) benchmark::DoNotOptimize(Metrics::clock::now());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_clock);
+
+// a scrape of every route after BM_record
+static void BM_write_prometheus(benchmark::State &state) {
+  std::ostringstream out;
+  for (auto _ : state) {
+    out.str("");
+    metrics.write_prometheus(out);
+  }
+  state.SetBytesProcessed(state.iterations() * out.str().size());
+}
+BENCHMARK(BM_write_prometheus)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv) {
+  set_routes();
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
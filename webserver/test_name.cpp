@@ -0,0 +1,113 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/ranked_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <random>
+#include <string>
+
+#include "compact_string.hpp"
+
+// Segment bytes per user with User::name as a boost::interprocess string
+// (32 bytes, 22 chars inline) and as a CompactString (24 bytes, 23 inline),
+// under the four indices of Ranking's container_t. Arguments are the number
+// of users and the name length. Same figures at 1M and 10M users:
+//   name length   12    23    40
+//   boost string  224   288   304
+//   CompactString 208   208   272
+namespace bip = boost::interprocess;
+using namespace boost::multi_index;
+
+typedef bip::managed_shared_memory::allocator<char>::type char_allocator;
+typedef bip::basic_string<char, std::char_traits<char>, char_allocator>
+    boost_string;
+typedef CompactString<char_allocator> compact_string;
+
+template <typename String>
+struct Record {
+  uint32_t uid;
+  String name;
+  uint32_t exp_pers;
+  uint32_t activity;
+  uint64_t hybrid;
+};
+
+template <typename String>
+using record_container_t = multi_index_container<
+    Record<String>,
+    indexed_by<
+        ranked_unique<
+            composite_key<
+                Record<String>,
+                member<Record<String>, uint32_t, &Record<String>::exp_pers>,
+                member<Record<String>, uint32_t, &Record<String>::uid>>,
+            composite_key_compare<std::greater<uint32_t>,
+                                  std::less<uint32_t>>>,
+        ranked_unique<
+            composite_key<
+                Record<String>,
+                member<Record<String>, uint32_t, &Record<String>::activity>,
+                member<Record<String>, uint32_t, &Record<String>::uid>>,
+            composite_key_compare<std::greater<uint32_t>,
+                                  std::less<uint32_t>>>,
+        ranked_unique<
+            composite_key<
+                Record<String>,
+                member<Record<String>, uint64_t, &Record<String>::hybrid>,
+                member<Record<String>, uint32_t, &Record<String>::uid>>,
+            composite_key_compare<std::greater<uint64_t>,
+                                  std::less<uint32_t>>>,
+        ordered_unique<member<Record<String>, uint32_t, &Record<String>::uid>>>,
+    typename bip::managed_shared_memory::allocator<Record<String>>::type>;
+
+static void Args_name(benchmark::internal::Benchmark *b) {
+  for (auto size : {1 << 20, 10000000})
+    for (auto len : {12, 23, 40}) b->Args({size, len});
+}
+
+template <typename String>
+static void BM_bytes_per_user(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0), len = state.range(1);
+  uint64_t mem_size = (1ull << 20) + size * 512ull;
+  std::mt19937 gen(0);
+  uint64_t used = 0;
+
+  // timing part
+  for (auto _ : state) {
+    bip::shared_memory_object::remove("TestNameMemory");
+    bip::managed_shared_memory segment(bip::create_only, "TestNameMemory",
+                                       mem_size);
+    char_allocator ca(segment.get_segment_manager());
+    auto users = segment.construct<record_container_t<String>>("Users")(
+        typename record_container_t<String>::ctor_args_list(),
+        segment.get_allocator<Record<String>>());
+    uint64_t free_before = segment.get_free_memory();
+
+    std::string name(len, 'n');
+    for (uint32_t i = 0; i < size; i++) {
+      uint32_t exp_pers = gen(), activity = gen();
+      users->insert(Record<String>{i, String(name.c_str(), ca), exp_pers,
+                                   activity, uint64_t(exp_pers) * 700 +
+                                                 uint64_t(activity) * 300});
+    }
+    used = free_before - segment.get_free_memory();
+  }
+  bip::shared_memory_object::remove("TestNameMemory");
+  state.counters["bytes_per_user"] = double(used) / size;
+  state.counters["sizeof_record"] = sizeof(Record<String>);
+}
+BENCHMARK_TEMPLATE(BM_bytes_per_user, boost_string)
+    ->Apply(Args_name)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_bytes_per_user, compact_string)
+    ->Apply(Args_name)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,167 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <istream>
+#include <list>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "http_parser.hpp"
+#include "user_parser.hpp"
+
+static const std::string requests[] = {
+    "GET /info?uid=12345 HTTP/1.1\r\n"
+    "Host: localhost:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept: */*\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+    "Origin: http://localhost\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+    "POST /put HTTP/1.1\r\n"
+    "Host: localhost:10000\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 55\r\n"
+    "\r\n"
+    "{\"uid\":12345,\"name\":\"alice\",\"exp_pers\":10,\"activity\":2}",
+};
+
+struct OldRequest {
+  std::string method, path, http_version;
+  std::string content;
+  std::unordered_map<std::string, std::string> header;
+};
+
+// Server::parse_request before the hand-written parser
+static OldRequest old_parse_request(std::istream& stream) {
+  OldRequest request;
+  std::regex e("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+
+  std::smatch sub_match;
+
+  std::string line;
+  getline(stream, line);
+
+  line.pop_back();
+  if (std::regex_match(line, sub_match, e)) {
+    request.method = sub_match[1];
+    request.path = sub_match[2];
+    request.http_version = sub_match[3];
+    bool matched;
+    e = "^([^:]*): ?(.*)$";
+    do {
+      getline(stream, line);
+      line.pop_back();
+      matched = std::regex_match(line, sub_match, e);
+      if (matched) {
+        request.header[sub_match[1]] = sub_match[2];
+      }
+    } while (matched == true);
+  }
+  // body
+  if (!stream.eof()) getline(stream, request.content);
+
+  return request;
+}
+
+static void BM_regex_parse(benchmark::State& state) {
+  const std::string& input = requests[state.range(0)];
+
+  for (auto _ : state) {
+    std::istringstream stream(input);
+    auto request = old_parse_request(stream);
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_regex_parse)->DenseRange(0, 1);
+
+static void BM_request_parser(benchmark::State& state) {
+  const std::string& input = requests[state.range(0)];
+  RequestParser parser;
+  Request request;
+
+  for (auto _ : state) {
+    parser.reset();
+    auto status = parser.parse(input.data(), input.data() + input.size(),
+                               request);
+    benchmark::DoNotOptimize(status);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_request_parser)->DenseRange(0, 1);
+
+// the same requests arriving a few bytes per read
+static void BM_request_parser_split(benchmark::State& state) {
+  const std::string& input = requests[state.range(0)];
+  const size_t chunk = 16;
+  RequestParser parser;
+  Request request;
+
+  for (auto _ : state) {
+    parser.reset();
+    auto status = RequestParser::Status::incomplete;
+    for (size_t end = chunk; status == RequestParser::Status::incomplete;
+         end += chunk)
+      status = parser.parse(input.data(),
+                            input.data() + std::min(end, input.size()),
+                            request);
+    benchmark::DoNotOptimize(status);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_request_parser_split)->DenseRange(0, 1);
+
+static const std::string put_bodies[] = {
+    "{\"uid\":12345,\"name\":\"alice\",\"exp_pers\":10,\"activity\":2}",
+    "{\n  \"uid\": 4000000000,\n  \"name\": \"a name past the inline capacity\",\n"
+    "  \"exp_pers\": 123456789,\n  \"activity\": 987654321\n}",
+    "{\"uid\":12345,\"name\":\"\\u00e9l\\u00e8ve \\\"b\\\"\",\"exp_pers\":10,"
+    "\"activity\":2}",
+};
+
+// the /put handler before UserParser, up to the values User::assign took
+static void BM_ptree_put(benchmark::State& state) {
+  const std::string& input = put_bodies[state.range(0)];
+  const std::list<std::string> json_fields = {"uid", "name", "exp_pers",
+                                              "activity"};
+
+  for (auto _ : state) {
+    std::stringstream post_stream;
+    post_stream << input;
+    boost::property_tree::ptree pt;
+    boost::property_tree::read_json(post_stream, pt);
+    auto iter = pt.begin();
+    for (auto field : json_fields)
+      if (((iter++)->first).compare(field)) state.SkipWithError("bad put");
+    iter = pt.begin();
+    uint32_t uid = (iter++)->second.get_value<uint32_t>();
+    std::string name = (iter++)->second.data();
+    uint32_t exp_pers = (iter++)->second.get_value<uint32_t>();
+    uint32_t activity = (iter++)->second.get_value<uint32_t>();
+    benchmark::DoNotOptimize(uid + exp_pers + activity);
+    benchmark::DoNotOptimize(name);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_ptree_put)->DenseRange(0, 2);
+
+static void BM_user_parser(benchmark::State& state) {
+  const std::string& input = put_bodies[state.range(0)];
+  UserParser parser;
+  UserFields fields;
+
+  for (auto _ : state) {
+    if (parser.parse(input, fields) != UserParser::Status::ok)
+      state.SkipWithError("bad put");
+    benchmark::DoNotOptimize(fields);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_user_parser)->DenseRange(0, 2);
+
+BENCHMARK_MAIN();
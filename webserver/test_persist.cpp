@@ -0,0 +1,97 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <memory>
+
+#include "ranking.hpp"
+#include "test.h"
+
+// Startup cost of a leaderboard of a given size: reloading every user into
+// a fresh shared memory segment, as a restart had to before, against
+// reattaching the mapped file a previous run left behind.
+static const char *data_file = "test_persist.dat";
+
+static void Args_persist(benchmark::internal::Benchmark *b) {
+  for (auto i : boost::irange(10, 19, 2)) b->Args({1 << i});
+}
+
+// about 250 bytes per user across the four indices, the name and the
+// distinct score sets
+static uint64_t mem_for(uint32_t size) { return (1 << 20) + size * 256ull; }
+
+static void BM_startup_reload(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::mt19937 gen(0);
+  std::vector<std::pair<uint32_t, uint32_t>> scores;
+  for (auto _ : boost::irange(size)) {
+    (void)_;
+    scores.emplace_back(gen(), gen());
+  }
+
+  // timing part
+  for (auto _ : state) {
+    std::unique_ptr<Ranking> rank(new Ranking(mem_for(size)));
+    for (auto i : boost::irange(size))
+      rank->put_user(User(i, {scores[i].first, scores[i].second}, "reload",
+                          rank->get_ca()));
+    benchmark::DoNotOptimize(rank->get_hybrid_rank(size / 2));
+    state.PauseTiming();
+    rank.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_startup_reload)->Apply(Args_persist);
+
+static void BM_startup_reattach(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::remove(data_file);
+  {
+    Ranking rank(mem_for(size), rank_mode::competition, HybridWeights(),
+                 data_file);
+    init_rank(rank, size);
+  }
+
+  // timing part
+  for (auto _ : state) {
+    std::unique_ptr<Ranking> rank(new Ranking(
+        mem_for(size), rank_mode::competition, HybridWeights(), data_file));
+    benchmark::DoNotOptimize(rank->get_hybrid_rank(size / 2));
+    state.PauseTiming();
+    rank.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+  std::remove(data_file);
+}
+BENCHMARK(BM_startup_reattach)->Apply(Args_persist);
+
+// a checkpoint after a burst of 100 writes
+static void BM_checkpoint(benchmark::State &state) {
+  // pre-set part
+  uint32_t size = state.range(0);
+  std::remove(data_file);
+  Ranking rank(mem_for(size), rank_mode::competition, HybridWeights(),
+               data_file);
+  init_rank(rank, size);
+  std::mt19937 gen(0);
+  User user(rank.get_ca());
+
+  // timing part
+  for (auto _ : state) {
+    for (auto _ : boost::irange(100)) {
+      (void)_;
+      user.uid = gen() % size;
+      user.score<tag_exp_pers>() = gen();
+      user.score<tag_activity>() = gen();
+      rank.modify_user(user);
+    }
+    rank.flush();
+  }
+  std::remove(data_file);
+}
+BENCHMARK(BM_checkpoint)->Apply(Args_persist);
+
+BENCHMARK_MAIN();
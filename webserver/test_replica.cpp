@@ -0,0 +1,103 @@
+#include <benchmark/benchmark.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "ranking.hpp"
+
+// One owner process writing and N replica processes answering rank queries
+// from the same segment. Every iteration forks the readers, which attach, run
+// a fixed number of queries and exit, while the owner keeps writing: modifies
+// of preset users and puts of new ones, so the segment also grows under the
+// readers. A reader that sees the size shrink fails the run.
+static const uint32_t preset_size = 1 << 16;
+static const uint32_t reader_queries = 1 << 14;
+
+static int read_replica(uint32_t seed) {
+  Ranking replica(boost::interprocess::open_only);
+  std::mt19937 gen(seed);
+  uint32_t last_size = preset_size;
+  for (uint32_t i = 0; i < reader_queries; i++) {
+    uint32_t size = replica.get_size();
+    if (size < last_size) return 1;
+    last_size = size;
+    benchmark::DoNotOptimize(replica.get_hybrid_rank(gen() % preset_size));
+  }
+  return 0;
+}
+
+static void BM_replica_reads(benchmark::State &state) {
+  // pre-set part
+  uint32_t readers = state.range(0);
+  Ranking rank;
+  std::mt19937 gen(0);
+  for (uint32_t i = 0; i < preset_size; i++) {
+    uint32_t exp_pers = gen(), activity = gen();
+    rank.put_user(User(i, {exp_pers, activity}, "preset", rank.get_ca()));
+  }
+  User user(rank.get_ca());
+  uint32_t next_uid = preset_size;
+  uint64_t writes = 0;
+
+  // timing part
+  for (auto _ : state) {
+    for (uint32_t r = 0; r < readers; r++)
+      if (fork() == 0) _exit(read_replica(r + 1));
+
+    uint32_t running = readers;
+    bool failed = false;
+    while (running) {
+      user.uid = next_uid++;
+      user.score<tag_exp_pers>() = gen();
+      user.score<tag_activity>() = gen();
+      rank.put_user(user);
+      user.uid = gen() % preset_size;
+      rank.modify_user(user);
+      writes += 2;
+
+      int status;
+      while (running && waitpid(-1, &status, WNOHANG) > 0) {
+        running--;
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+      }
+    }
+    if (failed) {
+      state.SkipWithError("a replica saw an inconsistent segment");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * readers * reader_queries);
+  state.counters["writes"] =
+      benchmark::Counter(writes, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_replica_reads)
+    ->DenseRange(1, 4)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Attaching a replica and detaching it, which scans the replica slots for
+// live pids. Once the owner leaves, the replica's queries must fail.
+static void BM_replica_attach(benchmark::State &state) {
+  // pre-set part
+  std::unique_ptr<Ranking> rank(new Ranking());
+
+  // timing part
+  for (auto _ : state) {
+    Ranking replica(boost::interprocess::open_only);
+    benchmark::DoNotOptimize(replica.get_size());
+  }
+
+  Ranking replica(boost::interprocess::open_only);
+  rank.reset();
+  try {
+    replica.get_size();
+    state.SkipWithError("a replica answered after its owner left");
+  } catch (const std::runtime_error &) {
+  }
+}
+BENCHMARK(BM_replica_attach);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,89 @@
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <map>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "router.hpp"
+
+typedef std::unordered_map<std::string, std::function<void(uint32_t&)>>
+    methods_t;
+typedef std::map<std::string, methods_t> table_t;
+
+static const std::vector<std::string> paths = {
+    "/info?uid=12345",        "/put",
+    "/remove?uid=42",         "/get_exp_pers?uid=4294967295",
+    "/get_activity?uid=7",    "/favicon.ico",
+    "/get_exp_pers?uid=abc",  "/info?uid=987654321",
+};
+
+static void fill(table_t& rc, table_t& exception_rc, bool regex) {
+  auto handler = [](uint32_t& hit) { hit++; };
+  const char* uid_routes[] = {"/info", "/remove", "/get_exp_pers",
+                              "/get_activity"};
+  for (auto route : uid_routes) {
+    if (regex)
+      rc[std::string("(") + route + "\\?uid=)(\\d+)$"]["GET"] = handler;
+    else
+      rc[std::string(route) + "?uid={uint}"]["GET"] = handler;
+  }
+  rc[regex ? "/put$" : "/put"]["POST"] = handler;
+  exception_rc[regex ? "(.*)" : "*"]["GET"] = handler;
+  exception_rc[regex ? "(.*)" : "*"]["OPTIONS"] = handler;
+}
+
+// the dispatch Server::respond used before the router
+static void BM_regex_dispatch(benchmark::State& state) {
+  table_t rc, exception_rc;
+  fill(rc, exception_rc, true);
+  std::vector<table_t::iterator> rc_vec;
+  for (auto it = rc.begin(); it != rc.end(); it++) rc_vec.push_back(it);
+  for (auto it = exception_rc.begin(); it != exception_rc.end(); it++)
+    rc_vec.push_back(it);
+  std::string method = "GET";
+  uint32_t hit = 0;
+
+  for (auto _ : state) {
+    for (auto& path : paths) {
+      for (auto res_it : rc_vec) {
+        std::regex e(res_it->first);
+        std::smatch sm_res;
+        if (std::regex_match(path, sm_res, e) &&
+            res_it->second.count(method)) {
+          if (sm_res.size() > 2) hit += std::stoul(sm_res[2], 0, 10);
+          res_it->second[method](hit);
+          break;
+        }
+      }
+    }
+  }
+  benchmark::DoNotOptimize(hit);
+  state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_regex_dispatch);
+
+static void BM_router_dispatch(benchmark::State& state) {
+  table_t rc, exception_rc;
+  fill(rc, exception_rc, false);
+  Router<methods_t> router;
+  router.compile(rc);
+  router.compile(exception_rc);
+  std::string method = "GET";
+  uint32_t hit = 0;
+
+  for (auto _ : state) {
+    for (auto& path : paths) {
+      auto match = router.match(path, method);
+      hit += match.param;
+      (*match.handler)(hit);
+    }
+  }
+  benchmark::DoNotOptimize(hit);
+  state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_router_dispatch);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,319 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "server.hpp"
+
+// In-process load test: a Server on its service threads, and clients on
+// blocking sockets in the benchmark threads, one connection each. Counts
+// every heap allocation in the process, both sides of the socket.
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static const uint32_t port = 10321;
+// users 1 to ranked_users are there for the rank queries
+static const uint32_t ranked_users = 4096;
+static Server* main_server;
+
+static const std::string info_request =
+    "GET /info?uid=1 HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "\r\n";
+
+// Reads until cnt responses are complete. Responses are told apart by their
+// Content-Length, what follows the last one stays in buffer.
+static void read_responses(boost::asio::ip::tcp::socket& socket,
+                           std::string& buffer, size_t cnt) {
+  char chunk[4096];
+  size_t done = 0, at = 0;
+  while (done < cnt) {
+    size_t head_end = buffer.find("\r\n\r\n", at);
+    if (head_end != std::string::npos) {
+      size_t len_at = buffer.find("Content-Length: ", at);
+      size_t body = head_end + 4;
+      size_t len = std::stoul(buffer.substr(len_at + 16));
+      if (buffer.size() >= body + len) {
+        at = body + len;
+        done++;
+        continue;
+      }
+    }
+    buffer.append(chunk, socket.read_some(boost::asio::buffer(chunk)));
+  }
+  buffer.erase(0, at);
+}
+
+// depth requests in flight per connection: 1 is plain keep-alive, more are
+// pipelined in one write
+static void BM_keep_alive(benchmark::State& state) {
+  size_t depth = state.range(0);
+  std::string batch;
+  for (size_t i = 0; i < depth; i++) batch += info_request;
+  boost::asio::io_service io;
+  boost::asio::ip::tcp::socket socket(io);
+  socket.connect(boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), port));
+  std::string buffer;
+  buffer.reserve(1 << 16);
+  // warm the session's buffers up
+  boost::asio::write(socket, boost::asio::buffer(batch));
+  read_responses(socket, buffer, depth);
+
+  uint64_t before = allocations.load();
+  for (auto _ : state) {
+    boost::asio::write(socket, boost::asio::buffer(batch));
+    read_responses(socket, buffer, depth);
+  }
+  // every thread sees the allocations of all of them
+  uint64_t requests = state.iterations() * depth * state.threads();
+  state.counters["allocs_per_request"] = benchmark::Counter(
+      double(allocations.load() - before) / requests,
+      benchmark::Counter::kAvgThreads);
+  state.SetItemsProcessed(state.iterations() * depth);
+}
+BENCHMARK(BM_keep_alive)
+    ->Arg(1)
+    ->Arg(16)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// a connection per request, closed by the server on Connection: close
+static void BM_connection_close(benchmark::State& state) {
+  const std::string request =
+      "GET /info?uid=1 HTTP/1.1\r\n"
+      "Connection: close\r\n"
+      "\r\n";
+  boost::asio::io_service io;
+  std::string buffer;
+
+  uint64_t before = allocations.load();
+  for (auto _ : state) {
+    boost::asio::ip::tcp::socket socket(io);
+    socket.connect(boost::asio::ip::tcp::endpoint(
+        boost::asio::ip::address_v4::loopback(), port));
+    boost::asio::write(socket, boost::asio::buffer(request));
+    read_responses(socket, buffer, 1);
+    char byte;
+    boost::system::error_code ec;
+    socket.read_some(boost::asio::buffer(&byte, 1), ec);
+    if (ec != boost::asio::error::eof) state.SkipWithError("left open");
+  }
+  state.counters["allocs_per_request"] =
+      double(allocations.load() - before) / state.iterations();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_connection_close)->UseRealTime();
+
+// keep-alive puts of a taken uid, answered once the batch writer has gone
+// over them, without holding a service thread meanwhile
+static void BM_put(benchmark::State& state) {
+  std::string body =
+      "{\"uid\":1,\"name\":\"load\",\"exp_pers\":1,\"activity\":1}";
+  std::string put = "POST /put HTTP/1.1\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\n\r\n" + body;
+  boost::asio::io_service io;
+  boost::asio::ip::tcp::socket socket(io);
+  socket.connect(boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), port));
+  std::string buffer;
+
+  for (auto _ : state) {
+    boost::asio::write(socket, boost::asio::buffer(put));
+    read_responses(socket, buffer, 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_put)->ThreadRange(1, 8)->UseRealTime();
+
+// Ranks of n users on two indices: one /ranks request for all of them, or
+// a /get_exp_pers and a /get_activity request for each, one at a time.
+static std::vector<uint32_t> some_uids(size_t n) {
+  std::mt19937 gen(n);
+  std::vector<uint32_t> uids(n);
+  for (auto& uid : uids) uid = gen() % ranked_users + 1;
+  return uids;
+}
+
+static void BM_ranks_batch(benchmark::State& state) {
+  std::string request = "GET /ranks?index=exp_pers,activity&uids=";
+  for (auto uid : some_uids(state.range(0)))
+    request += std::to_string(uid) + ",";
+  request += " HTTP/1.1\r\n\r\n";
+  boost::asio::io_service io;
+  boost::asio::ip::tcp::socket socket(io);
+  socket.connect(boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), port));
+  std::string buffer;
+
+  for (auto _ : state) {
+    boost::asio::write(socket, boost::asio::buffer(request));
+    read_responses(socket, buffer, 1);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ranks_batch)->RangeMultiplier(16)->Range(16, 4096)->UseRealTime();
+
+static void BM_ranks_single(benchmark::State& state) {
+  std::vector<std::string> requests;
+  for (auto uid : some_uids(state.range(0)))
+    for (auto path : {"/get_exp_pers?uid=", "/get_activity?uid="})
+      requests.push_back("GET " + std::string(path) + std::to_string(uid) +
+                         " HTTP/1.1\r\n\r\n");
+  boost::asio::io_service io;
+  boost::asio::ip::tcp::socket socket(io);
+  socket.connect(boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), port));
+  std::string buffer;
+
+  for (auto _ : state) {
+    for (auto& request : requests) {
+      boost::asio::write(socket, boost::asio::buffer(request));
+      read_responses(socket, buffer, 1);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ranks_single)
+    ->RangeMultiplier(16)
+    ->Range(16, 4096)
+    ->UseRealTime();
+
+// keep-alive requests, one in flight, with request logging at info (1) and
+// off (0)
+static void BM_logging(benchmark::State& state) {
+  if (state.thread_index() == 0)
+    main_server->get_logger().set_level(state.range(1) ? log_level::info
+                                                       : log_level::off);
+  BM_keep_alive(state);
+  if (state.thread_index() == 0)
+    main_server->get_logger().set_level(log_level::info);
+}
+BENCHMARK(BM_logging)
+    ->ArgsProduct({{1}, {0, 1}})
+    ->Threads(1)
+    ->Threads(4)
+    ->UseRealTime();
+
+// Server threads from 1 to 16 under both threading models, against 16
+// keep-alive clients. Each run has a server of its own, on a file so it
+// leaves the shared memory of the main one alone.
+static std::unique_ptr<Server> scaling_server;
+static std::thread scaling_service;
+
+static void BM_scaling(benchmark::State& state) {
+  threading model = state.range(0) ? threading::per_core : threading::shared;
+  uint32_t server_threads = state.range(1);
+  uint32_t scaling_port = port + 1 + state.range(0) * 32 + server_threads;
+  std::string data_file =
+      "test_server_" + std::to_string(scaling_port) + ".dat";
+  if (state.thread_index() == 0) {
+    std::remove(data_file.c_str());
+    scaling_server.reset(
+        new Server(scaling_port, server_threads, data_file, false, model));
+    scaling_service = std::thread([]() { scaling_server->start(); });
+  }
+
+  boost::asio::io_service io;
+  boost::asio::ip::tcp::socket socket(io);
+  std::string buffer;
+  for (auto _ : state) {
+    // connect once the server of thread 0 is listening
+    if (!socket.is_open()) {
+      state.PauseTiming();
+      boost::system::error_code ec;
+      do {
+        socket.close();
+        socket.connect(boost::asio::ip::tcp::endpoint(
+                           boost::asio::ip::address_v4::loopback(),
+                           scaling_port),
+                       ec);
+      } while (ec);
+      state.ResumeTiming();
+    }
+    boost::asio::write(socket, boost::asio::buffer(info_request));
+    read_responses(socket, buffer, 1);
+  }
+  socket.close();
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    scaling_server->stop();
+    scaling_service.join();
+    scaling_server.reset();
+    std::remove(data_file.c_str());
+  }
+}
+BENCHMARK(BM_scaling)
+    ->ArgsProduct({{0, 1}, {1, 2, 4, 8, 16}})
+    ->Threads(16)
+    ->UseRealTime();
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+
+  // the server logs every request to std::cout, which goes to /dev/null;
+  // the results go around it
+  std::ostream results(std::cout.rdbuf());
+  benchmark::ConsoleReporter reporter(benchmark::ConsoleReporter::OO_Tabular);
+  reporter.SetOutputStream(&results);
+  reporter.SetErrorStream(&std::cerr);
+  std::filebuf devnull;
+  devnull.open("/dev/null", std::ios::out);
+  std::cout.rdbuf(&devnull);
+
+  Server server(port, 4);
+  main_server = &server;
+  std::thread service([&server]() { server.start(); });
+  {
+    // the user every request asks for
+    boost::asio::io_service io;
+    boost::asio::ip::tcp::socket socket(io);
+    boost::system::error_code ec;
+    do {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      socket.connect(boost::asio::ip::tcp::endpoint(
+                         boost::asio::ip::address_v4::loopback(), port),
+                     ec);
+    } while (ec);
+    std::string body =
+        "{\"uid\":1,\"name\":\"load\",\"exp_pers\":1,\"activity\":1}";
+    std::string put = "POST /put HTTP/1.1\r\nContent-Length: " +
+                      std::to_string(body.size()) + "\r\n\r\n" + body;
+    boost::asio::write(socket, boost::asio::buffer(put));
+    std::string buffer;
+    read_responses(socket, buffer, 1);
+
+    // and the ones the rank queries ask for
+    std::string users;
+    for (uint32_t uid = 2; uid <= ranked_users; uid++)
+      users += "{\"uid\":" + std::to_string(uid) + ",\"name\":\"load\"," +
+               "\"exp_pers\":" + std::to_string(uid * 7919 % 1000) +
+               ",\"activity\":" + std::to_string(uid % 97) + "}\n";
+    std::string bulk_put = "POST /bulk_put HTTP/1.1\r\nContent-Length: " +
+                           std::to_string(users.size()) + "\r\n\r\n" + users;
+    boost::asio::write(socket, boost::asio::buffer(bulk_put));
+    read_responses(socket, buffer, 1);
+  }
+
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  server.stop();
+  service.join();
+  // devnull goes before the logger's last drain
+  std::cout.rdbuf(nullptr);
+  return 0;
+}
@@ -3,6 +3,6 @@
 int main() {
   Ranking rank;
   User user(rank.get_ca());
-  //   rank.put_user(User(1, 2, 3, "a", rank.get_ca()));
+  //   rank.put_user(User(1, {2, 3}, "a", rank.get_ca()));
   //   std::cout << rank.get_exp_pers_rank(1) << std::endl;
 }
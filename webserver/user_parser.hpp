@@ -0,0 +1,233 @@
+#ifndef _USER_PARSER_HPP_
+#define _USER_PARSER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <string>
+
+#include "schema.hpp"
+
+// The fields of a /put body. name points into the body, or into the parser
+// when it had escapes to decode, and is valid until either changes.
+struct UserFields {
+  uint32_t uid = 0;
+  scores_t scores = {};
+  boost::string_view name;
+};
+
+// Single-pass parser for the one JSON object /put takes,
+//
+//   {"uid": 1, "name": "alice", "exp_pers": 10, "activity": 2}
+//
+// with uid, name and every score of score_fields, in any order. Numbers are
+// decimal uint32_t, quoted or not; name is a string. Nothing is built on the
+// way: numbers are accumulated as they are read and a name without escapes
+// is handed out as a view of the body. A name with escapes is decoded into a
+// buffer kept across calls, so a parser reused per connection stops
+// allocating once it has seen its longest name.
+class UserParser {
+ public:
+  // bad_json: not one JSON object; bad_field: a member missing, repeated,
+  // unknown or of the wrong type
+  enum class Status { ok, bad_json, bad_field };
+
+  Status parse(boost::string_view body, UserFields& fields) {
+    p = body.data();
+    end = p + body.size();
+    status = Status::ok;
+    unsigned seen = 0;
+
+    skip_ws();
+    if (!take('{')) return Status::bad_json;
+    skip_ws();
+    if (!take('}')) {
+      do {
+        boost::string_view key;
+        skip_ws();
+        if (!string(key, decoded_key)) return fail(Status::bad_json);
+        skip_ws();
+        if (!take(':')) return Status::bad_json;
+        skip_ws();
+
+        int field = field_of(key);
+        if (field < 0 || seen & (1u << field)) return fail(Status::bad_field);
+        seen |= 1u << field;
+        if (field == name_field ? !name(fields.name)
+                                : !number(number_field(fields, field)))
+          return status;
+        skip_ws();
+      } while (take(','));
+      if (!take('}')) return Status::bad_json;
+    }
+    skip_ws();
+    if (p != end) return Status::bad_json;
+    return seen == all_fields ? Status::ok : Status::bad_field;
+  }
+
+ private:
+  // The numeric members: uid, then the scores in score_fields order.
+  static constexpr int number_field_cnt = 1 + score_field_cnt;
+  static uint32_t& number_field(UserFields& fields, int i) {
+    return i ? fields.scores[i - 1] : fields.uid;
+  }
+  // fields are numbered like that, name comes after them
+  static constexpr int name_field = number_field_cnt;
+  static constexpr unsigned all_fields = (1u << (number_field_cnt + 1)) - 1;
+
+  const char* p = nullptr;
+  const char* end = nullptr;
+  Status status = Status::ok;
+  // names and keys with escapes, apart so a key cannot clobber the name
+  std::string decoded, decoded_key;
+
+  static int field_of(boost::string_view key) {
+    if (key == "uid") return 0;
+    if (key == "name") return name_field;
+    int score = score_field_of(key);
+    return score < 0 ? -1 : 1 + score;
+  }
+
+  Status fail(Status s) {
+    status = s;
+    return s;
+  }
+
+  void skip_ws() {
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      p++;
+  }
+
+  bool take(char ch) {
+    if (p == end || *p != ch) return false;
+    p++;
+    return true;
+  }
+
+  // a JSON value of another type than the member takes is a bad_field, one
+  // that is no JSON at all a bad_json
+  bool other_value() {
+    if (p == end) return fail(Status::bad_json), false;
+    char ch = *p;
+    bool json = ch == '{' || ch == '[' || ch == '"' || ch == '-' ||
+                (ch >= '0' && ch <= '9') || ch == 't' || ch == 'f' ||
+                ch == 'n';
+    fail(json ? Status::bad_field : Status::bad_json);
+    return false;
+  }
+
+  bool number(uint32_t& value) {
+    bool quoted = take('"');
+    const char* digits = p;
+    uint64_t v = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+      v = v * 10 + (*p++ - '0');
+      if (v > UINT32_MAX) return fail(Status::bad_field), false;
+    }
+    if (p == digits) {
+      if (quoted) return fail(Status::bad_field), false;
+      return other_value();
+    }
+    // no leading zeros, fractions or exponents
+    if ((*digits == '0' && p - digits > 1) ||
+        (p != end && (*p == '.' || *p == 'e' || *p == 'E')))
+      return fail(Status::bad_field), false;
+    if (quoted && !take('"')) return fail(Status::bad_field), false;
+    value = static_cast<uint32_t>(v);
+    return true;
+  }
+
+  bool name(boost::string_view& value) {
+    if (p == end || *p != '"') return other_value();
+    if (!string(value, decoded)) return fail(Status::bad_json), false;
+    return true;
+  }
+
+  // a quoted string, p past its closing quote on success
+  bool string(boost::string_view& value, std::string& buf) {
+    if (!take('"')) return false;
+    const char* begin = p;
+    while (p != end && *p != '"' && *p != '\\') {
+      if (static_cast<unsigned char>(*p) < 0x20) return false;
+      p++;
+    }
+    if (p == end) return false;
+    if (*p == '"') {
+      value = boost::string_view(begin, p++ - begin);
+      return true;
+    }
+
+    // escapes: decode from the start of the string on
+    static const char escapes[] = "\"\\/bfnrt";
+    static const char unescaped[] = "\"\\/\b\f\n\r\t";
+    buf.assign(begin, p - begin);
+    while (p != end && *p != '"') {
+      if (static_cast<unsigned char>(*p) < 0x20) return false;
+      if (*p != '\\') {
+        buf.push_back(*p++);
+        continue;
+      }
+      if (++p == end) return false;
+      char ch = *p++;
+      if (ch == 'u') {
+        if (!unicode(buf)) return false;
+        continue;
+      }
+      const char* esc = ch ? strchr(escapes, ch) : nullptr;
+      if (!esc) return false;
+      buf.push_back(unescaped[esc - escapes]);
+    }
+    if (!take('"')) return false;
+    value = buf;
+    return true;
+  }
+
+  bool hex4(uint32_t& cp) {
+    if (end - p < 4) return false;
+    cp = 0;
+    for (int i = 0; i < 4; i++, p++) {
+      char ch = *p;
+      uint32_t d = (ch >= '0' && ch <= '9')   ? ch - '0'
+                   : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10
+                   : (ch >= 'A' && ch <= 'F') ? ch - 'A' + 10
+                                              : 16;
+      if (d == 16) return false;
+      cp = cp << 4 | d;
+    }
+    return true;
+  }
+
+  // \uXXXX, p past the 'u', written out as UTF-8
+  bool unicode(std::string& buf) {
+    uint32_t cp;
+    if (!hex4(cp)) return false;
+    if (cp >= 0xdc00 && cp <= 0xdfff) return false;
+    if (cp >= 0xd800 && cp <= 0xdbff) {
+      uint32_t low;
+      if (end - p < 2 || p[0] != '\\' || p[1] != 'u') return false;
+      p += 2;
+      if (!hex4(low) || low < 0xdc00 || low > 0xdfff) return false;
+      cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+    }
+    if (cp < 0x80) {
+      buf.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+      buf.push_back(static_cast<char>(0xc0 | cp >> 6));
+      buf.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+      buf.push_back(static_cast<char>(0xe0 | cp >> 12));
+      buf.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+      buf.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else {
+      buf.push_back(static_cast<char>(0xf0 | cp >> 18));
+      buf.push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3f)));
+      buf.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+      buf.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    }
+    return true;
+  }
+};
+
+#endif  // !_USER_PARSER_HPP_